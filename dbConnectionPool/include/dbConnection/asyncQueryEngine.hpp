@@ -0,0 +1,81 @@
+#ifndef ASYNCQUERYENGINE_H
+#define ASYNCQUERYENGINE_H
+#include<vector>
+#include<mutex>
+#include<atomic>
+#include<future>
+#include<thread>
+#include<memory>
+#include<map>
+#include<chrono>
+#include<functional>
+#include<condition_variable>
+#include"connectionPool.hpp"
+
+//异步执行一条SQL的结果
+struct AsyncQueryResult
+{
+    bool ok=false;
+    unsigned int errNo=0;
+    string error;
+    //非查询语句影响的行数
+    unsigned long long affectedRows=0;
+    //查询语句的结果集，NULL字段为空字符串
+    vector<vector<string>> rows;
+    //超过查询超时时间被中止，此时连接已经不可用，归还时会被连接池关闭
+    bool timedOut=false;
+};
+
+//完成回调在事件循环线程中执行，不能在回调里做阻塞操作
+using AsyncQueryCallback=function<void(AsyncQueryResult&)>;
+
+//基于libmysqlclient非阻塞接口和epoll的查询引擎：
+//少量事件循环线程同时驱动大量在途查询，查询等待服务器响应期间不占用任何线程
+class AsyncQueryEngine
+{
+public:
+    //loopNum为事件循环线程数；queryTimeoutMs为每个查询从提交到完成的时间上限，0表示不限制
+    AsyncQueryEngine(ConnectionPool* pool,int loopNum=1,int queryTimeoutMs=0);
+    //等待所有正在获取连接和在途的查询完成后退出事件循环
+    ~AsyncQueryEngine();
+
+    AsyncQueryEngine(const AsyncQueryEngine&)=delete;
+    AsyncQueryEngine& operator=(const AsyncQueryEngine&)=delete;
+
+    //从连接池异步借一个连接执行sql，完成后调用callback，借不到连接时回调失败结果
+    //连接池被取空时不阻塞调用线程，拿到连接后在连接池的异步线程中提交查询
+    bool execute(const string& sql,AsyncQueryCallback callback);
+    //使用调用者已借出的连接执行sql，连接在回调结束后归还
+    bool execute(PooledConnection conn,const string& sql,AsyncQueryCallback callback);
+    //使用调用者持有的连接执行sql，连接的所有权不转移，回调之前调用者不能使用该连接
+    //协程在多条查询之间保持同一个连接（例如事务）时使用
+    bool execute(Connection* conn,const string& sql,AsyncQueryCallback callback);
+    //future形式的接口
+    future<AsyncQueryResult> execute(const string& sql);
+
+private:
+    struct QueryOp;
+    struct EventLoop;
+
+    //把查询交给一个事件循环，引擎已停止时回调失败结果并返回false
+    bool submit(QueryOp* op);
+    //事件循环线程主函数
+    void loopTask(EventLoop* loop);
+    //推进一个查询的状态机，直到需要等待socket就绪或查询结束
+    void step(EventLoop* loop,QueryOp* op);
+    //查询结束，注销socket、执行回调并归还连接
+    void finish(EventLoop* loop,QueryOp* op);
+    //中止超过截止时间的查询，返回距离下一个截止时间的毫秒数，没有时返回-1
+    int expireQueries(EventLoop* loop);
+
+    ConnectionPool* _pool;
+    int _queryTimeoutMs;
+    //正在等待连接池分配连接的查询数，析构时等待它们全部提交
+    mutex _acquireMtx;
+    condition_variable _acquireCv;
+    int _acquiring;
+    vector<unique_ptr<EventLoop>> _loops;
+    //按轮询方式把查询分配给事件循环
+    atomic_uint _nextLoop;
+};
+#endif
@@ -0,0 +1,93 @@
+#ifndef AWAITABLE_H
+#define AWAITABLE_H
+#include<coroutine>
+#include<atomic>
+#include<exception>
+#include"connectionPool.hpp"
+#include"asyncQueryEngine.hpp"
+
+//不等待结果的协程返回类型：协程创建后立即开始执行，执行结束后自动销毁
+struct AsyncTask
+{
+    struct promise_type
+    {
+        AsyncTask get_return_object(){return AsyncTask();}
+        suspend_never initial_suspend() noexcept{return suspend_never();}
+        suspend_never final_suspend() noexcept{return suspend_never();}
+        void return_void(){}
+        void unhandled_exception(){terminate();}
+    };
+};
+
+//异步操作的回调可能在await_suspend返回之前同步执行（例如有空闲连接时），
+//用一次状态交换决定由回调还是await_suspend继续执行协程，避免在回调中递归恢复协程
+class AwaitCompletion
+{
+public:
+    //发起异步操作之前记录要恢复的协程
+    void arm(coroutine_handle<> handle){_handle=handle;}
+    //异步操作完成时调用：协程已经挂起时恢复它，executor不为空时在executor上恢复
+    void complete(const ConnectionExecutor& executor=nullptr);
+    //发起异步操作之后调用，返回值作为await_suspend的返回值，操作已经完成时返回false，协程直接继续执行
+    bool suspend();
+
+private:
+    enum State{INIT,SUSPENDED,DONE};
+    coroutine_handle<> _handle;
+    atomic<int> _state{INIT};
+};
+
+//co_await asyncAcquire(pool)得到PooledConnection，超时时为空
+//等待连接期间协程挂起，不占用线程；拿到连接后在executor上恢复，没有executor时在完成获取的线程上恢复
+class AcquireAwaitable
+{
+public:
+    AcquireAwaitable(ConnectionPool* pool,int timeoutMs,ConnectionExecutor executor)
+        :_pool(pool),_timeoutMs(timeoutMs),_executor(move(executor)){}
+
+    bool await_ready() const noexcept{return false;}
+    bool await_suspend(coroutine_handle<> handle);
+    PooledConnection await_resume(){return move(_conn);}
+
+private:
+    ConnectionPool* _pool;
+    int _timeoutMs;
+    ConnectionExecutor _executor;
+    PooledConnection _conn;
+    AwaitCompletion _completion;
+};
+
+//co_await asyncQuery(engine,conn,sql)得到AsyncQueryResult，连接仍由协程持有，可以继续执行下一条语句
+//等待服务器响应期间协程挂起，由事件循环驱动查询；完成后在executor上恢复，
+//没有executor时在事件循环线程上恢复，此时协程在下一次co_await之前不能有阻塞操作
+class QueryAwaitable
+{
+public:
+    QueryAwaitable(AsyncQueryEngine* engine,Connection* conn,const string& sql,ConnectionExecutor executor)
+        :_engine(engine),_conn(conn),_sql(sql),_executor(move(executor)){}
+
+    bool await_ready() const noexcept{return false;}
+    bool await_suspend(coroutine_handle<> handle);
+    AsyncQueryResult await_resume(){return move(_result);}
+
+private:
+    AsyncQueryEngine* _engine;
+    Connection* _conn;
+    string _sql;
+    ConnectionExecutor _executor;
+    AsyncQueryResult _result;
+    AwaitCompletion _completion;
+};
+
+//timeoutMs小于0时使用maxConnectionTimeout
+inline AcquireAwaitable asyncAcquire(ConnectionPool* pool,int timeoutMs=-1,ConnectionExecutor executor=nullptr)
+{
+    return AcquireAwaitable(pool,timeoutMs,move(executor));
+}
+
+inline QueryAwaitable asyncQuery(AsyncQueryEngine* engine,PooledConnection& conn,const string& sql,
+                                ConnectionExecutor executor=nullptr)
+{
+    return QueryAwaitable(engine,conn.get(),sql,move(executor));
+}
+#endif
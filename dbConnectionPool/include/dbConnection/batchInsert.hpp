@@ -0,0 +1,70 @@
+#ifndef BATCHINSERT_H
+#define BATCHINSERT_H
+#include<vector>
+#include"public.hpp"
+
+class Connection;
+
+//一条多行INSERT执行失败的信息，行号从0开始按addRow的顺序计数
+struct BatchError
+{
+    size_t firstRow;
+    size_t rowCount;
+    unsigned int errNo;
+    string error;
+};
+
+//多行批量插入：addRow追加的行拼接成INSERT ... VALUES (...),(...)，
+//单条语句的长度接近服务器max_allowed_packet时自动发送，flush发送剩余的行
+class BatchInsert
+{
+public:
+    //insertHead是VALUES之前的部分，例如"insert into user(name,age,sex)"
+    BatchInsert(Connection* conn,const string& insertHead);
+    //析构时不会自动flush，未发送的行被丢弃
+    ~BatchInsert()=default;
+
+    //追加一行，每个值都会被转义并作为字符串字面量写入
+    bool addRow(const vector<string>& values);
+    //逐个追加当前行的值，endRow结束这一行，返回值与addRow相同
+    //addValue转义后作为字符串字面量写入，addNull写入NULL，addDefault写入DEFAULT（使用列的默认值）
+    void addValue(const string& value);
+    void addNull();
+    void addDefault();
+    bool endRow();
+    //发送所有尚未发送的行，自上一次flush以来的语句全部成功返回true
+    bool flush();
+
+    //尚未发送的行数
+    size_t pendingRows() const{return _stmtRows;}
+    //累计成功写入的行数
+    unsigned long long affectedRows() const{return _affectedRows;}
+    //所有失败语句的信息
+    const vector<BatchError>& errors() const{return _errors;}
+
+private:
+    //发送当前拼好的语句并开始下一条
+    bool sendStatement();
+    //在当前行中追加一个已经格式化好的值
+    void appendValue(const string& literal);
+
+    Connection* _conn;
+    string _head;
+    //单条语句的长度上限
+    size_t _maxStmtLen;
+    //正在拼接的语句
+    string _sql;
+    //正在拼接的行，为空表示还没有开始
+    string _row;
+    //正在拼接的语句包含的行数及其第一行的行号
+    size_t _stmtRows;
+    size_t _stmtFirstRow;
+    //已追加的总行数
+    size_t _rowCnt;
+    unsigned long long _affectedRows;
+    //自上一次flush以来是否有语句失败
+    bool _failed;
+    vector<BatchError> _errors;
+};
+
+#endif
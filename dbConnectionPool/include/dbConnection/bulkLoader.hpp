@@ -0,0 +1,99 @@
+#ifndef BULKLOADER_H
+#define BULKLOADER_H
+#include<deque>
+#include<vector>
+#include<mutex>
+#include<functional>
+#include<string_view>
+#include<condition_variable>
+#include"public.hpp"
+
+class Connection;
+
+//批量导入的一个数据块，按LOAD DATA默认格式编码：字段以制表符分隔，行以换行结尾，反斜杠转义
+class BulkChunk
+{
+public:
+    //追加一个字段，制表符、换行、回车、反斜杠和\0会被转义
+    void addField(string_view value);
+    //追加一个NULL字段
+    void addNull();
+    //结束当前行
+    void endRow();
+    //追加一整行
+    void addRow(const vector<string>& values);
+
+    //已编码的字节数和行数
+    size_t bytes() const{return _data.size();}
+    size_t rows() const{return _rows;}
+
+private:
+    friend class BulkLoader;
+    //开始一个新的块，保留缓冲区的容量
+    void reset();
+
+    string _data;
+    size_t _rows=0;
+    //当前行还没有字段
+    bool _rowStart=true;
+};
+
+//生产者：每次调用向块中追加若干行，返回false表示之后没有更多数据（这次追加的行仍会导入）
+using BulkProducer=function<bool(BulkChunk& chunk)>;
+
+//通过LOAD DATA LOCAL INFILE从内存批量导入，不经过临时文件：
+//生产者在单独的线程中生成数据块放入有界队列，发送线程在客户端库读取本地文件的回调中从队列取块，
+//因此服务器接收当前块时生产者已经在生成下一块；连接需要打开localInfile
+class BulkLoader
+{
+public:
+    //columns为空时按表的列顺序导入；chunkBytes是单个数据块的大小，maxChunks是队列中最多缓存的块数
+    BulkLoader(Connection* conn,const string& table,const vector<string>& columns=vector<string>(),
+            size_t chunkBytes=1<<20,size_t maxChunks=4);
+
+    BulkLoader(const BulkLoader&)=delete;
+    BulkLoader& operator=(const BulkLoader&)=delete;
+
+    //运行一次导入，直到生产者返回false且所有数据发送完毕，成功返回true
+    bool load(const BulkProducer& producer);
+    //上一次导入中生产者生成的行数和服务器导入的行数
+    unsigned long long producedRows() const{return _producedRows;}
+    unsigned long long affectedRows() const{return _affectedRows;}
+
+private:
+    //客户端库读取本地文件的回调，userdata为BulkLoader
+    static int infileInit(void** ptr,const char* filename,void* userdata);
+    static int infileRead(void* ptr,char* buf,unsigned int len);
+    static void infileEnd(void* ptr);
+    static int infileError(void* ptr,char* msg,unsigned int len);
+
+    //生产者线程：生成数据块放入队列，队列满时等待
+    void produceTask(const BulkProducer& producer);
+    //发送线程取下一块，当前块归还给生产者复用；没有更多数据时返回false
+    bool nextChunk();
+
+    Connection* _conn;
+    string _sql;
+    size_t _chunkBytes;
+    size_t _maxChunks;
+
+    mutex _mtx;
+    condition_variable _cv;
+    //生成好等待发送的块
+    deque<BulkChunk> _queue;
+    //发送完的块，生产者复用它们的缓冲区
+    vector<BulkChunk> _free;
+    //生产者已经结束
+    bool _produceDone;
+    //发送端已经结束（完成或出错），生产者不再生成
+    bool _cancel;
+
+    //正在发送的块及其发送位置，只在发送线程中访问
+    BulkChunk _current;
+    size_t _offset;
+
+    unsigned long long _producedRows;
+    unsigned long long _affectedRows;
+};
+
+#endif
@@ -2,7 +2,31 @@
 #define CONNECTION_H
 #include<mysql/mysql.h>
 #include<ctime>
+#include<chrono>
+#include<list>
+#include<memory>
+#include<unordered_map>
+#include<vector>
 #include"public.hpp"
+#include"preparedStatement.hpp"
+#include"resultSet.hpp"
+#include"queryCache.hpp"
+
+class BatchInsert;
+
+//多语句流水线中一条语句的执行结果
+struct PipelineResult
+{
+    //服务器是否执行了这条语句，前面的语句出错后服务器不再执行后续语句
+    bool executed=false;
+    bool ok=false;
+    unsigned int errNo=0;
+    string error;
+    //非查询语句影响的行数
+    unsigned long long affectedRows=0;
+    //查询语句的结果集，NULL字段为空字符串
+    vector<vector<string>> rows;
+};
 
 class Connection
 {
@@ -11,23 +35,142 @@ public:
     Connection();
     //释放数据库连接
     ~Connection();
+    //连接时是否打开CLIENT_MULTI_STATEMENTS，需要在connect之前设置
+    void setMultiStatements(bool on){_multiStatements=on;}
+    //连接是否打开了CLIENT_MULTI_STATEMENTS
+    bool multiStatements() const{return _multiStatements;}
+    //是否允许LOAD DATA LOCAL INFILE，需要在connect之前设置，服务器也需要打开local_infile
+    void setLocalInfile(bool on);
+    //建立连接的超时时间（秒），需要在connect之前设置
+    void setConnectTimeout(unsigned int seconds);
     //连接数据库
     bool connect(string ip,unsigned short port,
                 string user,string passwd,
                 string dbname);
     //对数据库进行操作，增加、删除、修改
     bool update(string sql);
-    //查询操作
-    MYSQL_RES* query(string sql);
+    //查询操作，返回流式结果集，查询失败时返回的结果集为空
+    //连接上同一时刻只有一个打开的结果集，执行下一条语句或者归还连接池时会自动关闭它
+    ResultSet query(string sql);
+    //关闭连接上还没有关闭的结果集，连接归还连接池时调用
+    void closeResult();
+    //经过查询结果缓存的查询，命中时不访问服务器，未命中时执行查询并把完整结果放入缓存
+    //不可缓存的语句或者没有设置缓存时直接查询，ttlMs小于0时使用缓存的默认有效期，失败返回nullptr
+    //缓存键由连接的当前数据库和规范化后的sql组成，没有选择数据库时不使用缓存
+    shared_ptr<const CachedResult> cachedQuery(const string& sql,int ttlMs=-1);
+    //设置查询结果缓存，update、pipeline和预处理语句执行的写语句会失效缓存中相关表的结果
+    //事务中的写语句在执行时和事务结束时各失效一次，事务进行期间cachedQuery不读写缓存
+    //fill为false时cachedQuery只读取缓存，不把自己的查询结果放进去
+    void setQueryCache(QueryCache* cache,bool fill=true){_queryCache=cache;_fillCache=fill;}
+    //连接当前使用的字符集名称
+    const char* charset(){return mysql_character_set_name(_conn);}
+    //连接的协议状态是否已经被打断（例如异步查询超时后关闭了socket），这样的连接归还时直接关闭
+    bool broken() const{return _broken;}
+    //连接上是否有还没有结束的事务，取自服务器在上一条语句的响应中返回的状态
+    bool inTransaction() const{return (_conn->server_status&SERVER_STATUS_IN_TRANS)!=0;}
+    //获取sql对应的预处理语句，先查本连接的语句缓存，未命中时在服务器端预处理并放入缓存
+    //缓存按最近最少使用淘汰，返回的指针在语句被淘汰前有效，失败返回nullptr
+    PreparedStatement* prepare(const string& sql);
+    //设置语句缓存的容量，为0时不缓存
+    void setStmtCacheSize(size_t size){_stmtCacheSize=size;}
+    //把多条语句放在一个包里发送，再用mysql_next_result依次取回每条语句的结果，结果与stmts一一对应
+    //连接打开了CLIENT_MULTI_STATEMENTS时只需要一次往返，否则临时打开多语句选项，额外多两次往返
+    //某条语句出错后服务器不再执行后续语句，它们的executed为false，全部成功返回true
+    bool pipeline(const vector<string>& stmts,vector<PipelineResult>& results);
+    //开始一次多行批量插入，insertHead是VALUES之前的部分，需要包含batchInsert.hpp
+    BatchInsert insertBatch(const string& insertHead);
+
+    //按当前连接的字符集转义字符串，结果可以放进单引号中作为字面量
+    string escape(const string& str);
+    //服务器允许的最大包大小，第一次调用时查询服务器并缓存
+    size_t maxAllowedPacket();
+    //上一条语句影响的行数
+    unsigned long long affectedRows(){return mysql_affected_rows(_conn);}
+    //上一条语句的错误码和错误信息
+    unsigned int errNo(){return mysql_errno(_conn);}
+    string error(){return mysql_error(_conn);}
+
+    //向服务器发送ping检查连接是否可用，成功时刷新最近一次确认可用的时间点
+    bool ping();
+    //刷新最近一次确认连接可用的时间点，连接建立、ping成功或者语句执行成功后调用
+    void refreshValidTime(){_validTime=chrono::steady_clock::now();}
+    //距离最近一次确认连接可用经过的毫秒数
+    long long getValidElapsed() const
+    {
+        return chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now()-_validTime).count();
+    }
 
     //刷新链接的起始空闲时间点
-    void refreshAliveTime(){_aliveTime=clock();}
-    //获取连接的空闲时间
-    clock_t getAliveTime(){return clock()-_aliveTime;}
+    void refreshAliveTime(){_aliveTime=chrono::steady_clock::now();}
+    //连接开始空闲的时间点
+    chrono::steady_clock::time_point getIdleSince() const{return _aliveTime;}
+    //获取连接的空闲时间（毫秒），使用单调时钟，与进程消耗的CPU时间无关
+    long long getAliveTime() const
+    {
+        return chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now()-_aliveTime).count();
+    }
+    //连接建立至今的时间（毫秒）
+    long long getAge() const
+    {
+        return chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now()-_createTime).count();
+    }
+    //连接建立的时间点
+    chrono::steady_clock::time_point getCreateTime() const{return _createTime;}
+    //设置连接的退役时间点，到期后连接在归还时被关闭
+    void setRetireTime(chrono::steady_clock::time_point time){_retireTime=time;}
+    chrono::steady_clock::time_point getRetireTime() const{return _retireTime;}
 
 private:
+    //语句执行之后调用：失效查询缓存中sql修改的表，事务中修改的表记下来，事务结束后再失效一次
+    //multiStatements表示sql中可能有多条用分号分隔的语句；没有设置查询缓存时不解析sql
+    void afterStatement(const string& sql,bool multiStatements);
+
+    //异步查询引擎需要直接驱动MYSQL句柄上的非阻塞接口
+    friend class AsyncQueryEngine;
+    //结果集移动或关闭时需要更新_activeResult
+    friend class ResultSet;
+    //定时轮直接维护连接中的链表节点
+    friend class IdleTimerWheel;
+    //批量导入需要在MYSQL句柄上设置LOCAL INFILE的回调
+    friend class BulkLoader;
+    //预处理的写语句执行后需要失效查询缓存
+    friend class PreparedStatement;
+
     MYSQL* _conn;
-    clock_t _aliveTime;//记录每个连接空闲状态的初始时间点
+    chrono::steady_clock::time_point _aliveTime;//记录每个连接空闲状态的初始时间点
+    //连接建立成功的时间点
+    chrono::steady_clock::time_point _createTime;
+    //最近一次确认连接可用的时间点
+    chrono::steady_clock::time_point _validTime;
+    //连接的退役时间点，为time_point::max()时永不退役
+    chrono::steady_clock::time_point _retireTime;
+
+    //预处理语句缓存，链表头部是最近使用的语句，索引按sql文本查找链表节点
+    using StmtEntry=pair<string,unique_ptr<PreparedStatement>>;
+    list<StmtEntry> _stmtLru;
+    unordered_map<string,list<StmtEntry>::iterator> _stmtIndex;
+    size_t _stmtCacheSize;
+    //缓存的max_allowed_packet，0表示还没有查询过
+    size_t _maxAllowedPacket;
+    //连接是否打开了CLIENT_MULTI_STATEMENTS
+    bool _multiStatements;
+    //协议状态已经被打断，不能再使用
+    bool _broken;
+    //空闲定时轮中的链表节点，_wheelSlot为-1表示不在定时轮中
+    Connection* _wheelPrev;
+    Connection* _wheelNext;
+    int _wheelSlot;
+    uint64_t _expireTick;
+    //连接上还没有关闭的结果集
+    ResultSet* _activeResult;
+    //查询结果缓存，可以为空
+    QueryCache* _queryCache;
+    //查询结果是否放入缓存
+    bool _fillCache;
+    //当前事务中修改过的表，_txnWriteAll表示修改了无法确定的表，事务结束时需要清空整个缓存
+    vector<string> _txnTables;
+    bool _txnWrite;
+    bool _txnWriteAll;
 };
 
 #endif
\ No newline at end of file
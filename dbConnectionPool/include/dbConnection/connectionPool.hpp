@@ -1,38 +1,319 @@
 #ifndef CONNECTIONPOOL_H
 #define CONNECTIONPOOL_H
 #include<mutex>
-#include<queue>
+#include<vector>
 #include<atomic>
 #include<memory>
+#include<cstdlib>
+#include<new>
 #include<functional>
 #include<thread>
 #include<condition_variable>
+#include<queue>
+#include<map>
+#include<future>
+#include<unordered_set>
 #include"connection.hpp"    
+#include"latencyHistogram.hpp"
+#include"poolStats.hpp"
+#include"idleTimerWheel.hpp"
+
+//按类型的对齐要求在堆上分配的数组，释放时逐个析构后free
+//C++17之前new不保证超过16字节的对齐，按缓存行对齐的类型需要用它分配
+template<typename T>
+struct AlignedArrayDeleter
+{
+    explicit AlignedArrayDeleter(size_t num=0):size(num){}
+    void operator()(T* ptr) const
+    {
+        for(size_t i=0;i<size;i++)
+        {
+            ptr[i].~T();
+        }
+        free(ptr);
+    }
+    //已经构造好的元素个数
+    size_t size;
+};
+template<typename T>
+using AlignedArray=unique_ptr<T[],AlignedArrayDeleter<T>>;
+
+//分配num个默认构造的T，起始地址按alignof(T)对齐
+template<typename T>
+AlignedArray<T> makeAlignedArray(size_t num)
+{
+    //aligned_alloc要求大小是对齐的整数倍，sizeof(T)本身就是alignof(T)的整数倍
+    T* ptr=static_cast<T*>(aligned_alloc(alignof(T),sizeof(T)*max<size_t>(num,1)));
+    if(ptr==nullptr)
+    {
+        throw bad_alloc();
+    }
+    AlignedArray<T> array(ptr,AlignedArrayDeleter<T>());
+    //构造到一半抛出异常时只析构已经构造好的元素
+    for(size_t i=0;i<num;i++)
+    {
+        new(ptr+i) T();
+        array.get_deleter().size++;
+    }
+    return array;
+}
+
+//空闲连接分片，每个分片有独立的互斥锁，借还连接时只锁住本核对应的分片
+//按缓存行对齐，避免相邻分片的锁产生伪共享
+struct alignas(64) IdleShard
+{
+    mutex mtx;
+    //按LIFO方式使用：队尾是最近归还的热连接，借出也从队尾取；
+    //队头因此始终是该分片中空闲最久的连接，回收线程从队头开始按空闲时长遍历
+    //使用vector而不是deque：借还只在尾部进行，容量只增不减，稳定后借还没有堆分配
+    vector<Connection*> que;
+    //que中每个连接的空闲到期时间，与que一起由mtx保护
+    IdleTimerWheel wheel;
+    //从本分片借出（不经过等待队列）的次数，只在持有mtx时修改，控制线程不加锁读取
+    atomic<uint64_t> borrowCnt{0};
+};
+
+//线程本地的连接缓存槽：线程归还的连接先放在这里，同一线程再次借用时直接取走，不访问分片和等待队列
+//只有所属线程和连接池的回收逻辑会访问，按缓存行对齐，不同线程的槽之间没有伪共享
+struct alignas(64) ThreadSlot
+{
+    atomic<Connection*> conn{nullptr};
+    //从本槽借出的次数，只由所属线程修改
+    atomic<uint64_t> hits{0};
+};
+
+class ConnectionPool;
+
+//从连接池借出的连接，独占所有权，只能移动不能拷贝，析构时把连接还给连接池
+//与shared_ptr加自定义删除器相比，借还过程既没有控制块的堆分配，也没有原子引用计数
+class PooledConnection
+{
+public:
+    PooledConnection():_pool(nullptr),_conn(nullptr){}
+    PooledConnection(nullptr_t):_pool(nullptr),_conn(nullptr){}
+    ~PooledConnection(){reset();}
+
+    PooledConnection(const PooledConnection&)=delete;
+    PooledConnection& operator=(const PooledConnection&)=delete;
+    PooledConnection(PooledConnection&& other) noexcept
+        :_pool(other._pool),_conn(other._conn)
+    {
+        other._pool=nullptr;
+        other._conn=nullptr;
+    }
+    PooledConnection& operator=(PooledConnection&& other) noexcept
+    {
+        if(this!=&other)
+        {
+            reset();
+            _pool=other._pool;
+            _conn=other._conn;
+            other._pool=nullptr;
+            other._conn=nullptr;
+        }
+        return *this;
+    }
+
+    Connection* operator->() const{return _conn;}
+    Connection& operator*() const{return *_conn;}
+    Connection* get() const{return _conn;}
+    //连接所属的连接池
+    ConnectionPool* getPool() const{return _pool;}
+    explicit operator bool() const{return _conn!=nullptr;}
+    bool operator==(nullptr_t) const{return _conn==nullptr;}
+    bool operator!=(nullptr_t) const{return _conn!=nullptr;}
+
+    //提前把连接还给连接池
+    void reset();
+    //转换为shared_ptr，最后一个所有者释放时归还连接，需要多个所有者共享连接时使用，会有一次堆分配
+    shared_ptr<Connection> share();
+
+private:
+    friend class ConnectionPool;
+    PooledConnection(ConnectionPool* pool,Connection* conn):_pool(pool),_conn(conn){}
+
+    ConnectionPool* _pool;
+    Connection* _conn;
+};
+
+//异步获取连接的完成回调，超时时参数为空的PooledConnection
+using AcquireCallback=function<void(PooledConnection)>;
+//执行完成回调的执行器，例如提交给线程池：[&pool](function<void()> task){pool.Submit(move(task));}
+using ConnectionExecutor=function<void(function<void()>)>;
 
 class ConnectionPool
 {
 public:
-    static ConnectionPool* getConnectionPool();//获取单例连接池对象
-    //从连接池中获取一个可用的连接，使用智能指针进行管理，当连接不使用时放回连接池不进行释放
-    shared_ptr<Connection> getConnection();
+    //默认连接池的名称，使用mysql.cnf中配置段之前的配置项
+    static constexpr const char* DEFAULT_POOL="default";
+    static ConnectionPool* getConnectionPool();//获取默认连接池对象
+    //获取名为name的连接池，第一次获取时按mysql.cnf中的[name]配置段建立，没有该配置段或者加载配置失败返回nullptr，
+    //加载失败的连接池不会被记住，下次获取时重新加载
+    //每个连接池有独立的连接数上限，批处理等负载放在单独的连接池中，不会占用延迟敏感请求的连接
+    static ConnectionPool* getConnectionPool(const string& name);
+    //mysql.cnf中配置的所有连接池名称，第一个是默认连接池
+    static vector<string> getPoolNames();
+    //按mysql.cnf中名为name的配置建立一个连接池，ip不为空时改为连接ip:port，用于给从库等其它实例建立连接池
+    //sharedQueryCache不为空时使用这个查询结果缓存而不是自己建立，但只读取不写入：
+    //从库有复制延迟，主库写入失效缓存之后从库读到的可能还是写入之前的数据，不能放进共享的缓存
+    //连接池的后台线程会一直运行，连接池对象建立后不能销毁
+    ConnectionPool(const string& name,const string& ip,unsigned short port,QueryCache* sharedQueryCache=nullptr);
+    //从连接池中获取一个可用的连接，由PooledConnection独占管理，离开作用域时放回连接池不进行释放
+    //超时获取不到连接时返回空的PooledConnection
+    PooledConnection getConnection();
+    //异步获取连接，不阻塞调用线程：有空闲连接时立即完成，否则加入等待队列，拿到连接或超时后调用callback
+    //callback通过executor执行；没有executor时，立即完成的在调用线程中执行，等待后完成的在连接池的异步线程中执行，
+    //此时callback中不能有阻塞操作。timeoutMs小于0时使用maxConnectionTimeout
+    void getConnectionAsync(AcquireCallback callback,ConnectionExecutor executor=nullptr,int timeoutMs=-1);
+    //异步获取连接，返回的future在拿到连接或超时后就绪
+    future<PooledConnection> getConnectionAsync(int timeoutMs=-1);
+    //连接池中所有连接共享的查询结果缓存，没有配置queryCacheSize时为nullptr
+    QueryCache* getQueryCache(){return _sharedQueryCache!=nullptr?_sharedQueryCache:_queryCache.get();}
+    //阻塞等待直到至少readyNum个初始连接建立完成（超过initSize按initSize计），
+    //或者初始连接全部尝试完毕，或者超时，达到readyNum返回true
+    //readyNum传1即可在第一个连接可用时开始对外服务
+    bool waitReady(int readyNum,int timeoutMs);
+    //连接池的统计快照，可导出为Prometheus文本或JSON
+    //借用的快速路径只在已经持有的分片锁内累加计数，统计不会给借还增加原子操作
+    PoolStats stats();
+    //借出未归还的连接数加上正在等待的线程数，用于在多个连接池之间做负载均衡
+    int outstanding() const{return _connectionCnt-_idleCnt+_waiterCnt;}
+    //熔断器是否打开，打开时没有空闲连接的获取会立即失败
+    bool breakerOpen() const{return _breakerOpen.load();}
+    //连接池名称
+    const string& getName() const{return _name;}
+    //配置加载成功、后台线程已经启动；加载配置失败的连接池不能使用
+    bool started() const{return _started;}
+    //mysql.cnf中配置的从库地址列表（ip:port）
+    const vector<string>& getReplicas() const{return _replicas;}
 
 private:
-    //创建初始化数目的连接
-    ConnectionPool();
-    //加载配置项
+    //PooledConnection析构时通过putIdleConnection归还连接
+    friend class PooledConnection;
+
+    //构造函数的公共部分：建立分片并启动后台线程
+    void start();
+    //加载配置项：先读取所有连接池共用的默认配置，再用[_name]配置段中的配置项覆盖
     bool loadConfigFile();
     //生产者线程，用于生成链接
     void produceConnectionTask();
-    //定时监督线程，用于监督队列中的空闲连接
+    //创建连接对象并应用连接级别的配置项
+    Connection* newConnection();
+    //以warmupConcurrency的并发度建立num个连接并放入连接池，每建立成功一个调用一次onCreated，返回成功的个数
+    int createConnections(int num,const function<void()>& onCreated=nullptr);
+    //预热线程，以warmupConcurrency的并发度建立initSize个初始连接
+    void warmupConnectionTask();
+    //定时监督线程，按定时轮的tick推进，在每个空闲连接到期时回收它
     void scannerConnectionTask();
+    //处理各分片定时轮中到tick为止到期的连接：连接总数多于initSize和目标连接数中较大者时关闭，否则重新计时
+    void reapIdleConnections(uint64_t tick);
+    //每次关闭各分片队头中空闲最久的一个连接，直到连接总数降到keepNum或没有空闲连接
+    void closeIdleConnections(int keepNum);
+    //新建立的连接加入连接池前调用：按maxLifetime和抖动计算退役时间，并登记提前建立替代连接的时间
+    void registerConnection(Connection* conn);
+    //注销并关闭连接，连接数等计数由调用者维护；所有被连接池关闭的连接都经过这里
+    void destroyConnection(Connection* conn);
+    //处理到期的替代连接请求，由监督线程每个tick调用
+    void requestSpareConnections();
+    //归还时已经到达退役时间且替代连接已经就绪的连接，在这里关闭并返回true
+    bool retireConnection(Connection* conn);
+    //替代连接已经就绪时消耗一个替代连接并注销conn，返回true后由调用者关闭conn
+    bool claimRetirement(Connection* conn);
+    //关闭到达退役时间后一直空闲在分片中的连接，由监督线程每个tick调用，轮换不依赖连接被借出再归还
+    void retireIdleConnections();
+    //时间点所在的定时轮tick
+    uint64_t tickOf(chrono::steady_clock::time_point time) const;
+    //连接空闲到期的tick
+    uint64_t idleExpireTick(Connection* conn) const;
+    //连接数控制线程，按借用速率、持有时间和等待时间的分位数调整目标连接数
+    void sizingControllerTask();
+
+    //连接空闲超过validationThreshold时先ping一次，失效的连接被关闭并返回false
+    bool validateConnection(Connection* conn);
+    //关闭一个已经不在分片中的连接，并通知生产者补充
+    void discardConnection(Connection* conn);
+    //保活线程，定期ping空闲较久的连接，失效的连接在被借出之前就被替换
+    void keepaliveConnectionTask();
+
+    //当前线程所在CPU对应的分片下标
+    int localShard() const;
+    //从本地分片取空闲连接，本地分片为空时依次从其它分片窃取，全部为空返回nullptr
+    //fastPath表示调用者是不经过等待队列的借用者，此时计入分片的借用次数
+    Connection* takeIdleConnection(bool fastPath=false);
+    //PooledConnection归还连接：打开线程缓存且没有等待者时放进当前线程的缓存槽，否则交给releaseIdleConnection
+    //新建立的连接不经过这里，直接交给releaseIdleConnection
+    void putIdleConnection(Connection* conn);
+    //把空闲连接交还给共享的部分：有等待者时直接交给等待最久的等待者，否则放回本地分片
+    void releaseIdleConnection(Connection* conn);
+
+    //当前线程在本连接池中的缓存槽，第一次调用时建立并登记
+    ThreadSlot* localSlot();
+    //从当前线程的缓存槽中取连接，没有返回nullptr
+    Connection* takeCachedConnection();
+    //线程退出时注销缓存槽，槽中的连接还给连接池
+    void releaseThreadSlot(ThreadSlot* slot);
+    //把线程缓存中的连接还给连接池：all为true时全部归还，否则只归还空闲超过threadCacheIdle的
+    void spillThreadCaches(bool all);
+    //等待者入队后把其它线程缓存中的连接交给等待队列；已有线程在做时直接返回，等待者不会排队争抢_slotMutex
+    void spillForWaiters();
+    //线程本地的缓存槽表，线程退出时注销其中所有的槽
+    struct ThreadSlotTable
+    {
+        vector<pair<ConnectionPool*,ThreadSlot*>> slots;
+        ~ThreadSlotTable();
+    };
 
+    //等待空闲连接的消费者，同步的在getConnection的栈上分配，异步的在堆上分配，按到达顺序串成双向链表
+    struct ConnectionWaiter
+    {
+        condition_variable cv;
+        //归还者直接交给该等待者的连接
+        Connection* conn=nullptr;
+        ConnectionWaiter* prev=nullptr;
+        ConnectionWaiter* next=nullptr;
 
+        //以下成员只用于异步获取连接，callback不为空表示异步等待者
+        AcquireCallback callback;
+        ConnectionExecutor executor;
+        chrono::steady_clock::time_point start;
+        chrono::steady_clock::time_point deadline;
+        //是否进入过等待队列
+        bool waited=false;
+        //熔断器打开时被移出等待队列，以空连接结束等待
+        bool rejected=false;
+        //在_asyncTimers中的位置
+        multimap<chrono::steady_clock::time_point,ConnectionWaiter*>::iterator timer;
+    };
+    //以下三个函数调用时必须持有_waitMutex
+    void enqueueWaiter(ConnectionWaiter* waiter);
+    void removeWaiter(ConnectionWaiter* waiter);
+    //把连接交给队头的等待者，没有等待者返回false
+    bool handoffLocked(Connection* conn);
+    //把分片中的空闲连接依次交给等待者，处理归还者和新等待者之间的竞争
+    void drainIdleToWaitersLocked();
+    //熔断器打开时让所有等待者立即失败
+    void rejectWaitersLocked();
+    //记录一次建立连接的结果，连续失败达到breakerThreshold时打开熔断器，成功时关闭
+    void recordConnectResult(bool ok);
+
+    //异步获取连接：先走快速路径，没有空闲连接时加入等待队列并登记截止时间
+    void acquireAsync(ConnectionWaiter* waiter);
+    //完成一次异步获取：在执行器上校验连接并调用回调，校验失败时保持原截止时间重新获取
+    void completeAsync(ConnectionWaiter* waiter);
+    //异步线程，完成被交接了连接的异步等待者，并让到达截止时间的异步等待者超时
+    void asyncAcquireTask();
+
+
+    //连接池名称，对应mysql.cnf中的配置段
+    string _name;
     //数据库连接配置
     string _ip;
     unsigned short _port;
     string _user;
     string _passwd;
     string _dbname;
+    //从库地址列表，只用于读写分离时给每个从库建立连接池
+    vector<string> _replicas;
 
     //连接池的初始连接量
     int _initSize;
@@ -42,14 +323,138 @@ private:
     int _maxIdleTime;
     //连接池获取连接的超时时间
     int _connectionTimeout;
+    //空闲连接的分片数，配置为0时取CPU核数
+    int _shardNum;
+    //预热初始连接时同时建立连接的最大线程数
+    int _warmupConcurrency;
+    //每个连接缓存的预处理语句数
+    int _stmtCacheSize;
+    //连接是否打开CLIENT_MULTI_STATEMENTS，打开后pipeline只需一次往返
+    bool _multiStatements;
+    //连接是否允许LOAD DATA LOCAL INFILE，批量导入需要打开
+    bool _localInfile;
+    //查询结果缓存的内存上限（字节），为0时不启用
+    size_t _queryCacheSize;
+    //查询结果缓存条目的默认有效期（毫秒）
+    int _queryCacheTtl;
+    unique_ptr<QueryCache> _queryCache;
+    //与其它连接池共享的查询结果缓存，不归本连接池所有
+    QueryCache* _sharedQueryCache;
+    //借出前校验连接的空闲阈值（毫秒），距上次确认可用超过该值才ping，为0时不校验
+    int _validationThreshold;
+    //保活线程ping空闲连接的周期（毫秒），为0时不启用
+    int _keepaliveInterval;
+    //连接数控制线程的调整周期（毫秒），为0时不启用，只在连接取空时逐个补充
+    int _sizingInterval;
+    //按Little定律估算出的连接数之上预留的余量（百分比）
+    int _sizingHeadroom;
+    //一个周期内获取连接等待时间的p99超过该值（毫秒）时立即扩容
+    int _growWaitThreshold;
+    //估算的连接数低于目标连接数的比例（百分比）超过该值才考虑缩容
+    int _shrinkHysteresis;
+    //连续多少个周期都满足缩容条件才真正缩容
+    int _shrinkDelay;
+
+    //线程缓存中的连接空闲超过该值（毫秒）后还给连接池，为0时不启用线程缓存
+    int _threadCacheIdle;
+    //所有线程在本连接池中的缓存槽，由_slotMutex保护
+    mutex _slotMutex;
+    vector<ThreadSlot*> _threadSlots;
+    //是否有线程正在为等待者清空线程缓存
+    atomic_bool _spilling;
+    //已注销的缓存槽累计的借出次数，由_slotMutex保护
+    uint64_t _releasedSlotHits;
+
+    //连接的最大存活时间（秒），为0时不轮换
+    int _maxLifetime;
+    //每个连接的存活时间在maxLifetime基础上随机缩短的最大比例（百分比），避免同一批连接同时退役
+    int _lifetimeJitter;
 
-    //存储mysql连接的队列
-    queue<Connection*> _connectionQue;
-    //维护连接队列的线程安全互斥锁
-    mutex _queueMutex;
+    //建立连接的超时时间（秒），为0时使用客户端库的默认值
+    int _connectTimeout;
+    //一个连接都没有建立成功后的重试间隔（毫秒）：从connectBackoffMin开始每次翻倍，不超过connectBackoffMax，
+    //实际等待时间在间隔的一半到全部之间随机，多个进程不会同时重连
+    int _backoffMin;
+    int _backoffMax;
+    //连续建立连接失败多少次后打开熔断器，为0时不熔断
+    int _breakerThreshold;
+    //连续建立连接失败的次数，成功一次清零
+    atomic_int _connectFailStreak;
+    //熔断器是否打开：打开时没有空闲连接的获取立即失败，不再等到超时；
+    //生产者按退避间隔继续试探，建立成功一个连接后关闭
+    atomic_bool _breakerOpen;
+
+    //连接轮换状态，由_rotationMutex保护
+    mutex _rotationMutex;
+    //连接池中所有存活的连接，用于确认替代请求对应的连接还没有被关闭
+    unordered_set<Connection*> _liveConns;
+    //替代连接请求：到期时间、连接和连接建立时间（区分同一地址上先后建立的不同连接）
+    struct SpareRequest
+    {
+        chrono::steady_clock::time_point due;
+        Connection* conn;
+        chrono::steady_clock::time_point createTime;
+        bool operator>(const SpareRequest& other) const{return due>other.due;}
+    };
+    priority_queue<SpareRequest,vector<SpareRequest>,greater<SpareRequest>> _spareDue;
+    //按退役时间排列的连接，结构与替代连接请求相同
+    priority_queue<SpareRequest,vector<SpareRequest>,greater<SpareRequest>> _retireDue;
+    //已经为其建立了替代连接、等待退役的连接
+    unordered_set<Connection*> _spareOwners;
+    //已经建立好的替代连接数，每退役一个连接消耗一个
+    int _spareCnt;
+    //生产者还需要建立的替代连接数，由_waitMutex保护
+    int _spareRequest;
+
+    //定时轮tick的起始时间点和长度
+    chrono::steady_clock::time_point _wheelEpoch;
+    static const int REAP_TICK_MS=100;
+    //到期的连接正被借出或者替代连接还没有就绪时，隔多久再检查一次
+    static const int RETIRE_RETRY_MS=1000;
+
+    //按CPU分片存储的空闲连接
+    AlignedArray<IdleShard> _shards;
+    //所有分片中空闲连接的总数，用于快速判空
+    atomic_int _idleCnt;
     //记录所创建连接的总数量
     atomic_int _connectionCnt;
-    //设置条件变量，供生产者消费者模型通信使用
-    condition_variable cv;
+    //正在等待空闲连接的消费者数量，归还连接时据此决定是否需要直接交接
+    atomic_int _waiterCnt;
+    //只在慢路径（无空闲连接需要等待）上使用的互斥锁，保护等待队列
+    mutex _waitMutex;
+    //先进先出的等待队列，每个等待者有自己的条件变量，归还连接时只唤醒得到连接的那一个
+    ConnectionWaiter* _waitHead;
+    ConnectionWaiter* _waitTail;
+    //生产者线程在此等待连接被取空
+    condition_variable _produceCv;
+    //异步等待者的截止时间，以及已经拿到连接或超时、等待异步线程完成的异步等待者，都由_waitMutex保护
+    multimap<chrono::steady_clock::time_point,ConnectionWaiter*> _asyncTimers;
+    vector<ConnectionWaiter*> _asyncDone;
+    //异步线程在此等待
+    condition_variable _asyncCv;
+    //异步线程在第一次异步获取连接时启动
+    once_flag _asyncOnce;
+    //控制线程给出的目标连接数，生产者会把连接总数补到该值
+    atomic_int _targetSize;
+    //进入慢路径的获取连接的等待时间（微秒），超时也会记录；快速路径的借用只计入分片的borrowCnt，等待时间视为0
+    LatencyHistogram _waitHist;
+    //成功建立连接的耗时（微秒）
+    LatencyHistogram _connectHist;
+    //获取连接超时次数、建立连接失败次数和关闭的连接数，都不在借还的快速路径上
+    atomic<uint64_t> _timeoutCnt;
+    //熔断器打开时立即失败的获取次数
+    atomic<uint64_t> _rejectCnt;
+    atomic<uint64_t> _connectFailCnt;
+    atomic<uint64_t> _closedCnt;
+
+    //预热状态，由_readyMutex保护
+    mutex _readyMutex;
+    condition_variable _readyCv;
+    //已经建立成功的初始连接数
+    int _warmedCnt;
+    //所有初始连接是否都已尝试建立，生产者线程会在不持有_readyMutex时读取
+    atomic_bool _warmupDone;
+    //构造时配置加载成功并调用了start
+    bool _started;
 };
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,30 @@
+#ifndef IDLETIMERWHEEL_H
+#define IDLETIMERWHEEL_H
+#include<cstdint>
+#include<vector>
+#include"public.hpp"
+
+class Connection;
+
+//空闲连接的哈希定时轮：每个槽是一条侵入式双向链表，链表节点就在Connection对象中，
+//加入和移除都是O(1)且没有堆分配；到期时间按tick计，超过一圈的条目在经过其所在槽时跳过
+//不是线程安全的，由所属分片的互斥锁保护
+class IdleTimerWheel
+{
+public:
+    explicit IdleTimerWheel(int slotNum=1024);
+
+    //在expireTick到期；已经过去的tick会在下一次推进时到期
+    void add(Connection* conn,uint64_t expireTick);
+    //连接不在定时轮中时什么也不做
+    void remove(Connection* conn);
+    //推进到tick，把到期tick不超过tick的连接移出定时轮并追加到expired中
+    void advance(uint64_t tick,vector<Connection*>& expired);
+
+private:
+    vector<Connection*> _slots;
+    //已经处理过的最后一个tick
+    uint64_t _currentTick;
+};
+
+#endif
@@ -0,0 +1,57 @@
+#ifndef LATENCYHISTOGRAM_H
+#define LATENCYHISTOGRAM_H
+#include<atomic>
+#include<vector>
+#include<cstdint>
+#include"public.hpp"
+
+//直方图某一时刻的计数快照，可以相减得到一段时间窗口内的分布
+struct HistogramSnapshot
+{
+    vector<uint64_t> counts;
+    //记录过的值的精确总和
+    uint64_t sum=0;
+
+    uint64_t total() const;
+    //第p百分位（0到100）所在桶的上界，没有样本时返回0
+    uint64_t percentile(double p) const;
+    //平均值，由精确总和计算
+    double mean() const;
+    HistogramSnapshot operator-(const HistogramSnapshot& other) const;
+};
+
+//HDR风格的对数线性直方图：小于16的值各占一个桶，之后每个2的幂区间再等分为16个子桶，
+//相对误差不超过1/16；记录只是两次无锁的原子自增，可以在多个线程中并发调用
+class LatencyHistogram
+{
+public:
+    static const int SUB_BUCKET_BITS=4;
+    static const int SUB_BUCKET_NUM=1<<SUB_BUCKET_BITS;
+    static const int BUCKET_NUM=(64-SUB_BUCKET_BITS+1)*SUB_BUCKET_NUM;
+
+    LatencyHistogram();
+
+    void record(uint64_t value)
+    {
+        _counts[bucketOf(value)].fetch_add(1,memory_order_relaxed);
+        _sum.fetch_add(value,memory_order_relaxed);
+    }
+    //一次记录count个相同的值
+    void record(uint64_t value,uint64_t count)
+    {
+        _counts[bucketOf(value)].fetch_add(count,memory_order_relaxed);
+        _sum.fetch_add(value*count,memory_order_relaxed);
+    }
+    HistogramSnapshot snapshot() const;
+
+    static int bucketOf(uint64_t value);
+    //桶中值的上界
+    static uint64_t bucketUpper(int bucket);
+
+private:
+    atomic<uint64_t> _counts[BUCKET_NUM];
+    //桶只保留值的范围，Prometheus的_sum和平均值需要精确的总和
+    atomic<uint64_t> _sum;
+};
+
+#endif
@@ -0,0 +1,42 @@
+#ifndef POOLSTATS_H
+#define POOLSTATS_H
+#include<cstdint>
+#include"latencyHistogram.hpp"
+#include"public.hpp"
+
+//连接池某一时刻的统计快照，由ConnectionPool::stats()生成
+struct PoolStats
+{
+    //连接总数、空闲连接数和借出连接数
+    int totalConnections=0;
+    int idleConnections=0;
+    int activeConnections=0;
+    //正在等待空闲连接的线程数
+    int waiters=0;
+    //连接数控制线程给出的目标连接数
+    int targetSize=0;
+    int maxSize=0;
+
+    //获取连接的总次数（包括超时的，不包括被熔断的）和超时次数
+    uint64_t acquires=0;
+    uint64_t timeouts=0;
+    //熔断器打开时立即失败的获取次数，以及熔断器当前是否打开
+    uint64_t breakerRejects=0;
+    bool breakerOpen=false;
+    //建立连接失败次数和关闭的连接数
+    uint64_t connectFailures=0;
+    uint64_t closedConnections=0;
+
+    //获取连接的等待时间分布（微秒），不需要等待的借用计为0
+    HistogramSnapshot acquireWaitUs;
+    //成功建立一个连接的耗时分布（微秒）
+    HistogramSnapshot connectLatencyUs;
+
+    //Prometheus文本格式，每个指标带pool标签
+    string toPrometheus(const string& poolName="default") const;
+    string toJson() const;
+    //先写入临时文件再rename，node_exporter的textfile采集器等读取方不会读到写了一半的文件
+    static bool writeFile(const string& path,const string& content);
+};
+
+#endif
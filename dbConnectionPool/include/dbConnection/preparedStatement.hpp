@@ -0,0 +1,86 @@
+#ifndef PREPAREDSTATEMENT_H
+#define PREPAREDSTATEMENT_H
+#include<mysql/mysql.h>
+#include<vector>
+#include<string_view>
+#include"public.hpp"
+
+class Connection;
+
+//服务器端预处理语句，参数通过二进制协议绑定，不需要把值格式化进SQL文本
+//由Connection的语句缓存创建和持有，随连接一起在连接池中复用
+class PreparedStatement
+{
+public:
+    //owner为创建语句的连接，写语句执行成功后通过它失效查询缓存
+    PreparedStatement(Connection* owner,MYSQL* conn);
+    ~PreparedStatement();
+
+    PreparedStatement(const PreparedStatement&)=delete;
+    PreparedStatement& operator=(const PreparedStatement&)=delete;
+
+    //在服务器端预处理sql，参数用?占位
+    bool prepare(const string& sql);
+    //参数个数
+    int paramCount() const{return _params.size();}
+
+    //按下标绑定参数，下标从0开始，绑定的值在下一次设置前一直有效
+    void setInt(int idx,long long value);
+    void setDouble(int idx,double value);
+    void setString(int idx,const string& value);
+    void setNull(int idx);
+
+    //执行语句，会先释放上一次执行还没有读完的结果集
+    //查询语句的结果集整体缓存在客户端，连接随后可以继续执行其他语句，再用fetch逐行读取
+    bool execute();
+    //上一次执行影响的行数，查询语句为结果集的行数
+    unsigned long long affectedRows();
+
+    //当前结果集的列数，没有结果集时为0
+    unsigned int fieldCount() const{return _columns.size();}
+    //读取下一行，没有更多行或出错返回false，读完后结果集自动释放
+    bool fetch();
+    //当前行第idx列的文本形式，NULL列返回data()为nullptr的空string_view，只在下一次fetch之前有效
+    string_view column(unsigned int idx) const
+    {
+        const Column& col=_columns[idx];
+        return col.isNull?string_view():string_view(col.buffer.data(),col.length);
+    }
+    bool isNull(unsigned int idx) const{return _columns[idx].isNull;}
+    //释放还没有读完的结果集
+    void freeResult();
+
+private:
+    //参数值的存储位置，MYSQL_BIND中的指针指向这里
+    struct Param
+    {
+        long long intValue=0;
+        double doubleValue=0;
+        string strValue;
+        unsigned long length=0;
+        bool isNull=true;
+    };
+
+    //结果集一列的接收缓冲区，MYSQL_BIND中的指针指向这里，所有类型都由客户端库转换为文本
+    struct Column
+    {
+        string buffer;
+        unsigned long length=0;
+        bool isNull=false;
+        bool truncated=false;
+    };
+
+    //把结果集的每一列绑定到_columns，缓冲区大小取该列在结果集中的最大长度
+    bool bindResult();
+
+    Connection* _owner;
+    MYSQL_STMT* _stmt;
+    //预处理的sql，用于判断执行的语句修改了哪些表
+    string _sql;
+    vector<MYSQL_BIND> _binds;
+    vector<Param> _params;
+    vector<MYSQL_BIND> _resultBinds;
+    vector<Column> _columns;
+};
+
+#endif
@@ -0,0 +1,116 @@
+#ifndef QUERYCACHE_H
+#define QUERYCACHE_H
+#include<list>
+#include<mutex>
+#include<atomic>
+#include<chrono>
+#include<memory>
+#include<vector>
+#include<unordered_map>
+#include<unordered_set>
+#include"public.hpp"
+
+//缓存的一次查询结果，NULL字段为空字符串
+struct CachedResult
+{
+    vector<string> fieldNames;
+    vector<vector<string>> rows;
+};
+
+//查询结果缓存的统计信息
+struct QueryCacheStats
+{
+    unsigned long long hits;
+    unsigned long long misses;
+    //因内存上限被淘汰的条目数
+    unsigned long long evictions;
+    //因TTL到期被丢弃的条目数
+    unsigned long long expirations;
+    //因写语句修改了相关的表而失效的条目数
+    unsigned long long invalidations;
+    size_t entries;
+    size_t bytes;
+};
+
+//客户端查询结果缓存：按规范化后的SQL文本缓存SELECT的结果，
+//总内存超过上限时按最近最少使用淘汰，每个条目有独立的TTL，
+//写语句涉及的表上的所有条目会被失效。多个连接共享同一个缓存，线程安全
+class QueryCache
+{
+public:
+    //maxBytes为缓存结果占用内存的上限，defaultTtlMs为默认的条目有效期
+    QueryCache(size_t maxBytes,int defaultTtlMs);
+
+    //查找规范化后的sql，未命中或已过期返回nullptr
+    shared_ptr<const CachedResult> get(const string& key);
+    //当前的失效版本号，每次失效都会增加；查询前取得，放入结果时据此判断查询期间相关的表有没有被修改
+    uint64_t version() const{return _version.load(memory_order_acquire);}
+    //放入一条结果，tables为查询读取的表，version是执行查询之前取得的版本号
+    //查询期间tables中的表被失效过时，结果可能是写入之前的旧数据，直接丢弃；ttlMs小于0时使用默认有效期
+    void put(const string& key,const vector<string>& tables,
+            shared_ptr<const CachedResult> result,uint64_t version,int ttlMs=-1);
+    //失效表table上的所有条目
+    void invalidateTable(const string& table);
+    //失效tables中的表上的所有条目，tables为空时清空整个缓存
+    void invalidateTables(const vector<string>& tables);
+    //失效写语句sql修改的表上的所有条目，解析不出表名时清空整个缓存
+    void invalidateFor(const string& sql,bool multiStatements=false);
+    //清空缓存
+    void clear();
+    QueryCacheStats stats();
+
+    //规范化sql：引号外的空白压缩为一个空格、保留字转为小写，去掉首尾空白和末尾的分号
+    //表名和别名保持原样，lower_case_table_names=0时Users和users是不同的表
+    static string normalize(const string& sql);
+    //规范化后的sql是否可以缓存：只缓存不加锁、不含时间和会话相关的函数、不读变量和系统库的SELECT
+    static bool cacheable(const string& normalizedSql);
+    //规范化后的SELECT读取的表，表名转为小写：只差大小写的表按同一张表失效，宁可多失效
+    static vector<string> readTables(const string& normalizedSql);
+    //sql的单词序列：跳过注释，引号中的字面量只保留引号，关键字和标识符转为小写，标点单独成词
+    static vector<string> tokens(const string& sql);
+    //sql修改的表：不修改数据的语句返回false，返回true且tables为空表示无法确定修改了哪些表
+    //只解析每条语句VALUES、SET或WHERE之前的部分；multiStatements为false时只解析第一条语句
+    static bool writeTargets(const string& sql,vector<string>& tables,bool multiStatements=false);
+
+private:
+    struct Entry
+    {
+        string key;
+        shared_ptr<const CachedResult> result;
+        vector<string> tables;
+        size_t bytes;
+        chrono::steady_clock::time_point expireAt;
+    };
+    using EntryIter=list<Entry>::iterator;
+
+    //以下函数调用时必须持有_mtx
+    void erase(EntryIter it);
+    void eraseTable(const string& table);
+    //失效一张表：记录新的版本号并删除该表上的条目
+    void invalidateLocked(const string& table);
+
+    size_t _maxBytes;
+    int _defaultTtlMs;
+
+    mutex _mtx;
+    //链表头部是最近使用的条目
+    list<Entry> _lru;
+    unordered_map<string,EntryIter> _index;
+    //表名到读取该表的条目key的索引
+    unordered_map<string,unordered_set<string>> _tableIndex;
+    size_t _usedBytes;
+    //最新的失效版本号，只在持有_mtx时增加
+    atomic<uint64_t> _version;
+    //每张表最近一次被失效时的版本号
+    unordered_map<string,uint64_t> _tableVersions;
+    //最近一次清空整个缓存时的版本号
+    uint64_t _clearVersion;
+
+    atomic<unsigned long long> _hits;
+    atomic<unsigned long long> _misses;
+    atomic<unsigned long long> _evictions;
+    atomic<unsigned long long> _expirations;
+    atomic<unsigned long long> _invalidations;
+};
+
+#endif
@@ -0,0 +1,39 @@
+#ifndef READWRITEROUTER_H
+#define READWRITEROUTER_H
+#include<atomic>
+#include<vector>
+#include"connectionPool.hpp"
+
+//读写分离：主库和每个从库各有一个连接池，写语句和事务走主库，
+//读语句按最少未完成请求数分配到从库，从库都不可用时退回主库
+class ReadWriteRouter
+{
+public:
+    //按mysql.cnf中的replicas配置项建立的单例，主库使用连接池单例，默认连接池建立失败时返回nullptr
+    static ReadWriteRouter* getRouter();
+    //primary为主库连接池，replicas为从库地址列表（ip:port），从库连接池使用与主库相同名称的配置
+    ReadWriteRouter(ConnectionPool* primary,const vector<string>& replicas);
+
+    //写语句和事务使用的主库连接
+    PooledConnection getWriteConnection();
+    //只读查询使用的连接：在熔断器没有打开的从库中选择借出连接数和等待者数之和最少的，
+    //从库获取连接超时时依次尝试其余从库，全部失败再使用主库
+    PooledConnection getReadConnection();
+    //按sql的类型选择主库或从库
+    PooledConnection getConnection(const string& sql);
+    //只读且可以在从库执行的语句返回true；加锁读、事务控制语句和不认识的语句都按写语句处理
+    //按单词判断，字符串字面量和注释中的内容不参与判断
+    static bool isReadOnly(const string& sql);
+
+    ConnectionPool* getPrimary(){return _primary;}
+    const vector<ConnectionPool*>& getReplicas(){return _replicas;}
+
+private:
+    ConnectionPool* _primary;
+    //从库连接池，与主库连接池一样不会被销毁
+    vector<ConnectionPool*> _replicas;
+    //负载相同时轮流选择的起点
+    atomic_uint _next;
+};
+
+#endif
@@ -0,0 +1,103 @@
+#ifndef RESULTSET_H
+#define RESULTSET_H
+#include<mysql/mysql.h>
+#include<string_view>
+#include<iterator>
+#include"public.hpp"
+
+class Connection;
+
+//结果集中的一行，每一列都是直接指向libmysqlclient行缓冲区的string_view，不做拷贝
+//只在取下一行或结果集关闭之前有效
+class Row
+{
+public:
+    size_t size() const{return _fieldNum;}
+    //NULL列返回data()为nullptr的空string_view
+    string_view operator[](size_t idx) const
+    {
+        return _row[idx]?string_view(_row[idx],_lengths[idx]):string_view();
+    }
+    bool isNull(size_t idx) const{return _row[idx]==nullptr;}
+
+private:
+    friend class ResultSet;
+
+    MYSQL_ROW _row=nullptr;
+    unsigned long* _lengths=nullptr;
+    unsigned int _fieldNum=0;
+};
+
+//流式结果集，独占mysql_use_result返回的MYSQL_RES，只能移动不能拷贝
+//析构或close时读完剩余的行并释放结果集；连接归还连接池时，还没有关闭的结果集由连接池自动关闭
+class ResultSet
+{
+public:
+    //单遍输入迭代器，每次自增读取下一行
+    class iterator
+    {
+    public:
+        using iterator_category=input_iterator_tag;
+        using value_type=Row;
+        using difference_type=ptrdiff_t;
+        using pointer=const Row*;
+        using reference=const Row&;
+
+        explicit iterator(ResultSet* rs=nullptr):_rs(rs){}
+        const Row& operator*() const{return _rs->_row;}
+        const Row* operator->() const{return &_rs->_row;}
+        iterator& operator++()
+        {
+            if(!_rs->next())
+            {
+                _rs=nullptr;
+            }
+            return *this;
+        }
+        bool operator==(const iterator& other) const{return _rs==other._rs;}
+        bool operator!=(const iterator& other) const{return _rs!=other._rs;}
+
+    private:
+        ResultSet* _rs;
+    };
+
+    //空结果集，查询失败时返回
+    ResultSet();
+    ResultSet(Connection* conn,MYSQL_RES* res);
+    ~ResultSet();
+
+    ResultSet(const ResultSet&)=delete;
+    ResultSet& operator=(const ResultSet&)=delete;
+    ResultSet(ResultSet&& other) noexcept;
+    ResultSet& operator=(ResultSet&& other) noexcept;
+
+    //查询是否成功并且结果集还没有关闭
+    explicit operator bool() const{return _res!=nullptr;}
+    //结果集的列数
+    unsigned int fieldCount() const{return _fieldNum;}
+    //第idx列的列名
+    string_view fieldName(unsigned int idx) const;
+
+    //读取下一行，没有更多行返回false
+    bool next();
+    //当前行
+    const Row& row() const{return _row;}
+    //从下一行开始遍历，只能遍历一次
+    iterator begin();
+    iterator end(){return iterator();}
+
+    //读完剩余的行并释放结果集，连接之后可以继续执行其他语句
+    void close();
+
+private:
+    //把连接上登记的活动结果集改为自己
+    void attach();
+
+    Connection* _conn;
+    MYSQL_RES* _res;
+    MYSQL_FIELD* _fields;
+    unsigned int _fieldNum;
+    Row _row;
+};
+
+#endif
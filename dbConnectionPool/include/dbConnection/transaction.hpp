@@ -0,0 +1,90 @@
+#ifndef TRANSACTION_H
+#define TRANSACTION_H
+#include<deque>
+#include<vector>
+#include<mutex>
+#include<thread>
+#include<future>
+#include<chrono>
+#include<condition_variable>
+#include"connectionPool.hpp"
+
+//作用域事务：构造时开始事务，commit提交，离开作用域时没有提交的事务自动回滚
+class Transaction
+{
+public:
+    //pipelineBegin为true且连接打开了multiStatements时，BEGIN不单独发送，
+    //与事务中的第一条update放在同一个多语句包中，省去一次往返；否则构造时立即发送BEGIN
+    explicit Transaction(Connection* conn,bool pipelineBegin=true);
+    //没有提交的事务自动回滚
+    ~Transaction();
+
+    Transaction(const Transaction&)=delete;
+    Transaction& operator=(const Transaction&)=delete;
+
+    //在事务中执行写语句，事务已经结束或者BEGIN失败时返回false
+    bool update(const string& sql);
+    //在事务中执行查询，事务已经结束或者BEGIN失败时返回空的结果集
+    ResultSet query(const string& sql);
+    //提交事务，无论成功与否事务都结束
+    bool commit();
+    //回滚事务
+    bool rollback();
+    //事务是否还没有结束
+    bool active() const{return _state!=DONE;}
+
+private:
+    enum State{PENDING_BEGIN,STARTED,DONE};
+    //补发推迟的BEGIN
+    bool beginNow();
+
+    Connection* _conn;
+    State _state;
+};
+
+//客户端组提交：多个线程提交的互相独立的小写事务，在一个刷新窗口内合并成一个服务器事务，
+//整组语句放在一个多语句包中发送，一次往返、一次提交
+//每个事务在自己的保存点中执行，某个事务的语句失败只回滚到它的保存点，不影响同组的其它事务
+//组内的事务在同一次COMMIT时一起生效，因此只适用于互相之间没有读写依赖的事务
+class GroupCommitter
+{
+public:
+    //windowMs是第一个事务到达后最多等待的时间，攒够maxGroupSize个事务时提前刷新
+    GroupCommitter(ConnectionPool* pool,int windowMs=5,size_t maxGroupSize=128);
+    //提交队列中剩余的事务后退出刷新线程
+    ~GroupCommitter();
+
+    GroupCommitter(const GroupCommitter&)=delete;
+    GroupCommitter& operator=(const GroupCommitter&)=delete;
+
+    //提交一个由若干写语句组成的事务，所在的组提交后future就绪，值为该事务是否成功提交
+    //服务器回滚了整个组（例如死锁、连接断开）时组内所有事务都失败，由调用者决定是否重试
+    future<bool> submit(vector<string> stmts);
+    //同步形式，阻塞到所在的组提交完成
+    bool execute(vector<string> stmts){return submit(move(stmts)).get();}
+
+private:
+    struct PendingTxn
+    {
+        vector<string> stmts;
+        promise<bool> done;
+        chrono::steady_clock::time_point arrive;
+    };
+
+    //刷新线程，按窗口和组大小取出一组事务提交
+    void flushTask();
+    //在一个连接上用一个服务器事务提交一组事务
+    void commitGroup(vector<PendingTxn>& group);
+
+    ConnectionPool* _pool;
+    int _windowMs;
+    size_t _maxGroupSize;
+
+    mutex _mtx;
+    condition_variable _cv;
+    deque<PendingTxn> _queue;
+    bool _stop;
+    thread _flusher;
+};
+
+#endif
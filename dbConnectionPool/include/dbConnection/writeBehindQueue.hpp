@@ -0,0 +1,97 @@
+#ifndef WRITEBEHINDQUEUE_H
+#define WRITEBEHINDQUEUE_H
+#include<vector>
+#include<mutex>
+#include<thread>
+#include<atomic>
+#include<chrono>
+#include<optional>
+#include<condition_variable>
+#include"connectionPool.hpp"
+
+//队列满时的处理方式：BLOCK阻塞调用者直到有空间，DROP丢弃这一行
+enum class OverflowPolicy
+{
+    BLOCK,
+    DROP
+};
+
+//写回队列中的一行，nullopt表示SQL NULL
+using WriteBehindRow=vector<optional<string>>;
+
+//写回队列的累计计数
+struct WriteBehindStats
+{
+    //进入队列的行数
+    unsigned long long enqueued=0;
+    //队列满时被丢弃的行数
+    unsigned long long dropped=0;
+    //写入成功的行数
+    unsigned long long written=0;
+    //所在语句执行失败，或者多次重试仍借不到连接而放弃的行数
+    unsigned long long failed=0;
+};
+
+//有界的写回队列：调用者只把行放进内存队列就返回，后台刷新线程借出一个连接，
+//用多行批量插入把攒下的行一起写入；攒够flushRows行或者最早的一行等待超过flushIntervalMs时刷新
+class WriteBehindQueue
+{
+public:
+    //insertHead是VALUES之前的部分，例如"insert into user(name,age,sex)"
+    //capacity是尚未写入（包括正在写入）的行数上限
+    //maxRetries是一批行借不到连接时最多重试的次数，超过后这批行计为失败，不再占用队列容量
+    WriteBehindQueue(ConnectionPool* pool,const string& insertHead,size_t capacity=65536,
+                    size_t flushRows=1000,int flushIntervalMs=100,OverflowPolicy policy=OverflowPolicy::BLOCK,
+                    int maxRetries=10);
+    //写入队列中剩余的行后退出刷新线程
+    ~WriteBehindQueue();
+
+    WriteBehindQueue(const WriteBehindQueue&)=delete;
+    WriteBehindQueue& operator=(const WriteBehindQueue&)=delete;
+
+    //追加一行，只做一次加锁和移动，不访问数据库；队列满且策略为DROP时丢弃并返回false
+    bool enqueue(WriteBehindRow row);
+    //立即刷新，阻塞到此前进入队列的行全部写入或失败，返回true；
+    //timeoutMs不小于0时最多等待这么久，超时返回false，没有写完的行仍留在队列中
+    bool flush(int timeoutMs=-1);
+    //累计计数
+    WriteBehindStats stats();
+
+private:
+    //刷新线程，按行数和时间触发，把当前缓冲区整体换出后在锁外写入
+    void flushTask();
+    //借一个连接把rows写入，返回失败的行数；借不到连接时返回-1，rows保留到下次重试
+    long long writeRows(vector<WriteBehindRow>& rows);
+
+    ConnectionPool* _pool;
+    string _insertHead;
+    size_t _capacity;
+    size_t _flushRows;
+    int _flushIntervalMs;
+    OverflowPolicy _policy;
+    int _maxRetries;
+
+    mutex _mtx;
+    //刷新线程在此等待行数或时间触发
+    condition_variable _flushCv;
+    //阻塞的调用者在此等待队列空间，flush的调用者在此等待写入完成
+    condition_variable _spaceCv;
+    //等待刷新的行，刷新线程整体换出，调用者追加时不会等待数据库
+    vector<WriteBehindRow> _buffer;
+    //缓冲区中最早的一行进入队列的时间
+    chrono::steady_clock::time_point _oldest;
+    //尚未写入（包括正在写入）的行数
+    size_t _queued;
+    //累计进入队列的行数和已经处理完（写入或失败）的行数，flush据此等待
+    unsigned long long _enqueuedSeq;
+    unsigned long long _doneSeq;
+    //有调用者在等待flush
+    bool _flushRequested;
+    bool _stop;
+    atomic<unsigned long long> _dropped;
+    atomic<unsigned long long> _written;
+    atomic<unsigned long long> _failed;
+    thread _flusher;
+};
+
+#endif
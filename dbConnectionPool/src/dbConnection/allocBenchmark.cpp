@@ -0,0 +1,97 @@
+#include<iostream>
+#include<chrono>
+#include<cstdlib>
+#include<new>
+#include"connectionPool.hpp"
+using namespace std;
+
+//借还连接的堆分配次数基准测试单独编译成allocBenchmark，
+//替换全局operator new只影响这个可执行文件，不影响connectionPool
+
+//统计当前线程的堆分配次数，用于验证借还连接的过程没有堆分配
+static thread_local size_t allocCount=0;
+
+static void* countedAlloc(size_t size)
+{
+    allocCount++;
+    void* p=malloc(size==0?1:size);
+    if(p==nullptr)
+    {
+        throw bad_alloc();
+    }
+    return p;
+}
+
+static void* countedAlloc(size_t size,align_val_t align)
+{
+    allocCount++;
+    size_t alignment=static_cast<size_t>(align);
+    //aligned_alloc要求大小是对齐值的整数倍
+    size=(size+alignment-1)/alignment*alignment;
+    void* p=aligned_alloc(alignment,size==0?alignment:size);
+    if(p==nullptr)
+    {
+        throw bad_alloc();
+    }
+    return p;
+}
+
+void* operator new(size_t size){return countedAlloc(size);}
+void* operator new[](size_t size){return countedAlloc(size);}
+void* operator new(size_t size,align_val_t align){return countedAlloc(size,align);}
+void* operator new[](size_t size,align_val_t align){return countedAlloc(size,align);}
+void* operator new(size_t size,const nothrow_t&) noexcept
+{
+    try{return countedAlloc(size);}catch(...){return nullptr;}
+}
+void* operator new[](size_t size,const nothrow_t&) noexcept
+{
+    try{return countedAlloc(size);}catch(...){return nullptr;}
+}
+void operator delete(void* p) noexcept{free(p);}
+void operator delete[](void* p) noexcept{free(p);}
+void operator delete(void* p,size_t) noexcept{free(p);}
+void operator delete[](void* p,size_t) noexcept{free(p);}
+void operator delete(void* p,align_val_t) noexcept{free(p);}
+void operator delete[](void* p,align_val_t) noexcept{free(p);}
+void operator delete(void* p,size_t,align_val_t) noexcept{free(p);}
+void operator delete[](void* p,size_t,align_val_t) noexcept{free(p);}
+void operator delete(void* p,const nothrow_t&) noexcept{free(p);}
+void operator delete[](void* p,const nothrow_t&) noexcept{free(p);}
+
+//借还连接的堆分配次数和耗时：PooledConnection直接借还，对比转换成shared_ptr的旧方式
+int main()
+{
+    const int ops=1000000;
+    ConnectionPool* cp=ConnectionPool::getConnectionPool();
+    if(cp==nullptr)
+    {
+        return 1;
+    }
+    cp->waitReady(1,5000);
+    {
+        //先借还一次，让分片容器分配好容量
+        PooledConnection warm=cp->getConnection();
+    }
+
+    size_t before=allocCount;
+    auto begin=chrono::steady_clock::now();
+    for(int i=0;i<ops;i++)
+    {
+        PooledConnection conn=cp->getConnection();
+    }
+    double ns=chrono::duration<double,nano>(chrono::steady_clock::now()-begin).count()/ops;
+    std::cout << "PooledConnection    allocs/op: " << double(allocCount-before)/ops
+              << "  ns/op: " << ns << std::endl;
+
+    before=allocCount;
+    begin=chrono::steady_clock::now();
+    for(int i=0;i<ops;i++)
+    {
+        shared_ptr<Connection> conn=cp->getConnection().share();
+    }
+    ns=chrono::duration<double,nano>(chrono::steady_clock::now()-begin).count()/ops;
+    std::cout << "shared_ptr<Connection> allocs/op: " << double(allocCount-before)/ops
+              << "  ns/op: " << ns << std::endl;
+    return 0;
+}
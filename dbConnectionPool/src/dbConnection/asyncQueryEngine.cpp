@@ -0,0 +1,383 @@
+#include"asyncQueryEngine.hpp"
+#include"public.hpp"
+#include<sys/epoll.h>
+#include<sys/eventfd.h>
+#include<sys/socket.h>
+#include<unistd.h>
+#include<cerrno>
+
+//一个在途查询的状态
+struct AsyncQueryEngine::QueryOp
+{
+    enum State{QUERY,FETCH,FREE};
+
+    //借出的连接由查询持有时，查询结束后归还；调用者自己持有连接时为空
+    PooledConnection owned;
+    //执行查询的连接
+    Connection* conn=nullptr;
+    string sql;
+    AsyncQueryCallback callback;
+    State state=QUERY;
+    MYSQL_RES* res=nullptr;
+    //socket是否已注册到epoll
+    bool armed=false;
+    //截止时间及其在事件循环定时器中的位置，没有超时时间时timed为false
+    chrono::steady_clock::time_point deadline;
+    multimap<chrono::steady_clock::time_point,QueryOp*>::iterator timer;
+    bool timed=false;
+    AsyncQueryResult result;
+};
+
+struct AsyncQueryEngine::EventLoop
+{
+    int epfd=-1;
+    //用于唤醒epoll_wait的eventfd
+    int wakefd=-1;
+    thread worker;
+
+    //新提交的查询，由mtx保护
+    mutex mtx;
+    vector<QueryOp*> pending;
+    bool stop=false;
+    //本循环上尚未结束的查询数，只在循环线程中访问
+    int inflight=0;
+    //有截止时间的在途查询，按截止时间排序，只在循环线程中访问
+    multimap<chrono::steady_clock::time_point,QueryOp*> timers;
+};
+
+//唤醒事件循环；计数器已满（EAGAIN）说明已经有未处理的唤醒，不需要再写
+static void wakeLoop(int fd)
+{
+    uint64_t one=1;
+    if(write(fd,&one,sizeof(one))!=(ssize_t)sizeof(one)&&errno!=EAGAIN)
+    {
+        LOG("唤醒事件循环失败！");
+    }
+}
+
+AsyncQueryEngine::AsyncQueryEngine(ConnectionPool* pool,int loopNum,int queryTimeoutMs)
+    :_pool(pool),_queryTimeoutMs(queryTimeoutMs),_acquiring(0),_nextLoop(0)
+{
+    for(int i=0;i<max(1,loopNum);i++)
+    {
+        unique_ptr<EventLoop> loop(new EventLoop());
+        loop->epfd=epoll_create1(EPOLL_CLOEXEC);
+        loop->wakefd=eventfd(0,EFD_NONBLOCK|EFD_CLOEXEC);
+        epoll_event ev{};
+        ev.events=EPOLLIN;
+        ev.data.ptr=nullptr;//data.ptr为空表示唤醒事件
+        epoll_ctl(loop->epfd,EPOLL_CTL_ADD,loop->wakefd,&ev);
+        loop->worker=thread(&AsyncQueryEngine::loopTask,this,loop.get());
+        _loops.push_back(move(loop));
+    }
+}
+
+AsyncQueryEngine::~AsyncQueryEngine()
+{
+    //还在等待连接的查询拿到连接（或超时）后会提交到事件循环，先等它们提交完
+    {
+        unique_lock<mutex> lock(_acquireMtx);
+        _acquireCv.wait(lock,[this](){return _acquiring==0;});
+    }
+    for(auto& loop:_loops)
+    {
+        {
+            lock_guard<mutex> lock(loop->mtx);
+            loop->stop=true;
+        }
+        wakeLoop(loop->wakefd);
+    }
+    for(auto& loop:_loops)
+    {
+        loop->worker.join();
+        close(loop->wakefd);
+        close(loop->epfd);
+    }
+}
+
+bool AsyncQueryEngine::execute(const string& sql,AsyncQueryCallback callback)
+{
+    {
+        lock_guard<mutex> lock(_acquireMtx);
+        _acquiring++;
+    }
+    //有空闲连接时回调在当前线程中立即执行，否则在连接池的异步线程中执行，调用线程都不会阻塞
+    _pool->getConnectionAsync([this,sql,callback](PooledConnection conn)
+    {
+        if(conn==nullptr)
+        {
+            AsyncQueryResult result;
+            result.error="获取连接失败";
+            callback(result);
+        }
+        else
+        {
+            execute(move(conn),sql,callback);
+        }
+        lock_guard<mutex> lock(_acquireMtx);
+        if(--_acquiring==0)
+        {
+            _acquireCv.notify_all();
+        }
+    });
+    return true;
+}
+
+bool AsyncQueryEngine::execute(PooledConnection conn,const string& sql,AsyncQueryCallback callback)
+{
+    QueryOp* op=new QueryOp();
+    op->conn=conn.get();
+    op->owned=move(conn);
+    op->sql=sql;
+    op->callback=move(callback);
+    return submit(op);
+}
+
+bool AsyncQueryEngine::execute(Connection* conn,const string& sql,AsyncQueryCallback callback)
+{
+    QueryOp* op=new QueryOp();
+    op->conn=conn;
+    op->sql=sql;
+    op->callback=move(callback);
+    return submit(op);
+}
+
+bool AsyncQueryEngine::submit(QueryOp* op)
+{
+    //调用者没有读完的流式结果集在这里关闭，否则非阻塞查询会因为命令不同步而失败
+    op->conn->closeResult();
+    if(_queryTimeoutMs>0)
+    {
+        op->deadline=chrono::steady_clock::now()+chrono::milliseconds(_queryTimeoutMs);
+        op->timed=true;
+    }
+    EventLoop* loop=_loops[_nextLoop++%_loops.size()].get();
+    {
+        lock_guard<mutex> lock(loop->mtx);
+        if(!loop->stop)
+        {
+            loop->pending.push_back(op);
+            op=nullptr;
+        }
+    }
+    if(op!=nullptr)
+    {
+        //引擎正在析构，不再接受新查询
+        op->result.error="查询引擎已停止";
+        op->callback(op->result);
+        delete op;
+        return false;
+    }
+    wakeLoop(loop->wakefd);
+    return true;
+}
+
+future<AsyncQueryResult> AsyncQueryEngine::execute(const string& sql)
+{
+    shared_ptr<promise<AsyncQueryResult>> prom=make_shared<promise<AsyncQueryResult>>();
+    future<AsyncQueryResult> fut=prom->get_future();
+    execute(sql,[prom](AsyncQueryResult& result)
+    {
+        prom->set_value(move(result));
+    });
+    return fut;
+}
+
+void AsyncQueryEngine::loopTask(EventLoop* loop)
+{
+    const int maxEvents=128;
+    epoll_event events[maxEvents];
+    int waitMs=-1;
+    while(1)
+    {
+        int n=epoll_wait(loop->epfd,events,maxEvents,waitMs);
+        for(int i=0;i<n;i++)
+        {
+            QueryOp* op=static_cast<QueryOp*>(events[i].data.ptr);
+            if(op!=nullptr)
+            {
+                step(loop,op);
+                continue;
+            }
+
+            //计数器为0时read返回EAGAIN，说明唤醒已经被处理过，同样去检查新提交的查询
+            uint64_t cnt;
+            if(read(loop->wakefd,&cnt,sizeof(cnt))<0&&errno!=EAGAIN)
+            {
+                LOG("读取事件循环唤醒计数失败！");
+            }
+            vector<QueryOp*> pending;
+            {
+                lock_guard<mutex> lock(loop->mtx);
+                pending.swap(loop->pending);
+            }
+            for(QueryOp* newOp:pending)
+            {
+                loop->inflight++;
+                if(newOp->timed)
+                {
+                    newOp->timer=loop->timers.emplace(newOp->deadline,newOp);
+                }
+                step(loop,newOp);
+            }
+        }
+        waitMs=expireQueries(loop);
+
+        //停止后不再有新查询，等在途查询全部结束再退出，避免把协议状态不完整的连接还回连接池
+        lock_guard<mutex> lock(loop->mtx);
+        if(loop->stop&&loop->pending.empty()&&loop->inflight==0)
+        {
+            return;
+        }
+    }
+}
+
+void AsyncQueryEngine::step(EventLoop* loop,QueryOp* op)
+{
+    MYSQL* mysql=op->conn->_conn;
+    net_async_status status=NET_ASYNC_COMPLETE;
+    while(1)
+    {
+        if(op->state==QueryOp::QUERY)
+        {
+            status=mysql_real_query_nonblocking(mysql,op->sql.c_str(),op->sql.size());
+            if(status==NET_ASYNC_COMPLETE)
+            {
+                if(mysql_field_count(mysql)==0)
+                {
+                    //非查询语句没有结果集
+                    op->result.ok=true;
+                    op->result.affectedRows=mysql_affected_rows(mysql);
+                    finish(loop,op);
+                    return;
+                }
+                op->res=mysql_use_result(mysql);
+                if(op->res==nullptr)
+                {
+                    status=NET_ASYNC_ERROR;
+                }
+                op->state=QueryOp::FETCH;
+            }
+        }
+        else if(op->state==QueryOp::FETCH)
+        {
+            MYSQL_ROW row=nullptr;
+            status=mysql_fetch_row_nonblocking(op->res,&row);
+            if(status==NET_ASYNC_COMPLETE)
+            {
+                if(row==nullptr)
+                {
+                    //结果集读完，mysql_errno不为0说明是读取途中出错
+                    op->result.ok=mysql_errno(mysql)==0;
+                    op->state=QueryOp::FREE;
+                }
+                else
+                {
+                    unsigned int fieldNum=mysql_num_fields(op->res);
+                    unsigned long* lengths=mysql_fetch_lengths(op->res);
+                    vector<string> fields;
+                    fields.reserve(fieldNum);
+                    for(unsigned int i=0;i<fieldNum;i++)
+                    {
+                        fields.emplace_back(row[i]?string(row[i],lengths[i]):string());
+                    }
+                    op->result.rows.push_back(move(fields));
+                }
+            }
+        }
+        else
+        {
+            status=mysql_free_result_nonblocking(op->res);
+            if(status==NET_ASYNC_COMPLETE)
+            {
+                op->res=nullptr;
+                finish(loop,op);
+                return;
+            }
+        }
+
+        if(status==NET_ASYNC_NOT_READY)
+        {
+            //socket暂时不可读写，注册到epoll后返回，就绪时再从当前状态继续
+            //使用边沿触发同时关注读写：非阻塞接口只在读写会阻塞时返回NOT_READY，
+            //之后socket状态的每次变化都恰好对应一次重试
+            if(!op->armed)
+            {
+                epoll_event ev{};
+                ev.events=EPOLLIN|EPOLLOUT|EPOLLET;
+                ev.data.ptr=op;
+                epoll_ctl(loop->epfd,EPOLL_CTL_ADD,mysql->net.fd,&ev);
+                op->armed=true;
+            }
+            return;
+        }
+        if(status==NET_ASYNC_ERROR)
+        {
+            op->result.ok=false;
+            if(op->res!=nullptr)
+            {
+                mysql_free_result(op->res);
+                op->res=nullptr;
+            }
+            finish(loop,op);
+            return;
+        }
+    }
+}
+
+int AsyncQueryEngine::expireQueries(EventLoop* loop)
+{
+    chrono::steady_clock::time_point now=chrono::steady_clock::now();
+    while(!loop->timers.empty()&&loop->timers.begin()->first<=now)
+    {
+        QueryOp* op=loop->timers.begin()->second;
+        loop->timers.erase(loop->timers.begin());
+        op->timed=false;
+        op->result.timedOut=true;
+        //非阻塞接口无法取消进行到一半的查询，关闭socket让客户端库立即以连接断开结束这次调用，
+        //连接的协议状态已经不完整，标记为不可用，归还时由连接池关闭
+        op->conn->_broken=true;
+        shutdown(op->conn->_conn->net.fd,SHUT_RDWR);
+        step(loop,op);
+    }
+    if(loop->timers.empty())
+    {
+        return -1;
+    }
+    //向上取整，避免在截止时间之前醒来空转
+    auto wait=chrono::duration_cast<chrono::milliseconds>(loop->timers.begin()->first-now)+chrono::milliseconds(1);
+    return wait.count();
+}
+
+void AsyncQueryEngine::finish(EventLoop* loop,QueryOp* op)
+{
+    MYSQL* mysql=op->conn->_conn;
+    if(op->armed)
+    {
+        epoll_ctl(loop->epfd,EPOLL_CTL_DEL,mysql->net.fd,nullptr);
+    }
+    if(op->timed)
+    {
+        loop->timers.erase(op->timer);
+    }
+    if(op->result.timedOut)
+    {
+        op->result.ok=false;
+        op->result.errNo=mysql_errno(mysql);
+        op->result.error="查询超时";
+        LOG("异步查询超时！");
+    }
+    else if(!op->result.ok)
+    {
+        op->result.errNo=mysql_errno(mysql);
+        op->result.error=mysql_error(mysql);
+        LOG("异步查询失败！");
+        LOG("错误信息："+op->result.error+"\n");
+    }
+    //与Connection::update一样失效查询结果缓存中被修改的表
+    op->conn->afterStatement(op->sql,op->conn->_multiStatements);
+    op->callback(op->result);
+    //析构PooledConnection，查询持有的连接归还连接池
+    delete op;
+    loop->inflight--;
+}
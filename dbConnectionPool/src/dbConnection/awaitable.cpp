@@ -0,0 +1,57 @@
+#include"awaitable.hpp"
+
+void AwaitCompletion::complete(const ConnectionExecutor& executor)
+{
+    //await_suspend还没有返回，由它返回false继续执行协程
+    if(_state.exchange(DONE)!=SUSPENDED)
+    {
+        return;
+    }
+    if(executor)
+    {
+        coroutine_handle<> handle=_handle;
+        executor([handle]()
+        {
+            handle.resume();
+        });
+    }
+    else
+    {
+        _handle.resume();
+    }
+}
+
+bool AwaitCompletion::suspend()
+{
+    return _state.exchange(SUSPENDED)!=DONE;
+}
+
+bool AcquireAwaitable::await_suspend(coroutine_handle<> handle)
+{
+    _completion.arm(handle);
+    //回调已经在executor上执行，直接恢复协程
+    _pool->getConnectionAsync([this](PooledConnection conn)
+    {
+        _conn=move(conn);
+        _completion.complete();
+    },_executor,_timeoutMs);
+    return _completion.suspend();
+}
+
+bool QueryAwaitable::await_suspend(coroutine_handle<> handle)
+{
+    if(_conn==nullptr)
+    {
+        //连接为空（例如获取连接超时）时直接返回失败结果，不挂起
+        _result.error="没有可用的连接";
+        return false;
+    }
+    _completion.arm(handle);
+    //回调在事件循环线程中执行，按需转到executor上恢复协程
+    _engine->execute(_conn,_sql,[this](AsyncQueryResult& result)
+    {
+        _result=move(result);
+        _completion.complete(_executor);
+    });
+    return _completion.suspend();
+}
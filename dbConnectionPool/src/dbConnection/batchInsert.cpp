@@ -0,0 +1,111 @@
+#include"batchInsert.hpp"
+#include"connection.hpp"
+
+BatchInsert::BatchInsert(Connection* conn,const string& insertHead)
+    :_conn(conn),_head(insertHead+" values"),_stmtRows(0),_stmtFirstRow(0),
+    _rowCnt(0),_affectedRows(0),_failed(false)
+{
+    //为包头和语句末尾留出余量
+    size_t packet=_conn->maxAllowedPacket();
+    _maxStmtLen=packet>1024?packet-1024:packet;
+    _sql.reserve(min<size_t>(_maxStmtLen,1<<20));
+}
+
+bool BatchInsert::addRow(const vector<string>& values)
+{
+    for(const string& value:values)
+    {
+        addValue(value);
+    }
+    return endRow();
+}
+
+void BatchInsert::addValue(const string& value)
+{
+    appendValue("'"+_conn->escape(value)+"'");
+}
+
+void BatchInsert::addNull()
+{
+    appendValue("NULL");
+}
+
+void BatchInsert::addDefault()
+{
+    appendValue("DEFAULT");
+}
+
+void BatchInsert::appendValue(const string& literal)
+{
+    _row+=_row.empty()?"(":",";
+    _row+=literal;
+}
+
+bool BatchInsert::endRow()
+{
+    string row=move(_row);
+    _row.clear();
+    //空行写成()，插入一行全部使用默认值
+    if(row.empty())
+    {
+        row="(";
+    }
+    row+=")";
+
+    if(_head.size()+row.size()+1>_maxStmtLen)
+    {
+        LOG("单行数据超过max_allowed_packet，无法插入！");
+        _errors.push_back({_rowCnt,1,0,"row exceeds max_allowed_packet"});
+        _failed=true;
+        _rowCnt++;
+        return false;
+    }
+
+    bool ok=true;
+    //加入这一行会超过包大小上限，先把已拼好的语句发出去
+    if(_stmtRows>0&&_sql.size()+row.size()+1>_maxStmtLen)
+    {
+        ok=sendStatement();
+    }
+    if(_stmtRows==0)
+    {
+        _sql=_head;
+        _stmtFirstRow=_rowCnt;
+    }
+    else
+    {
+        _sql+=",";
+    }
+    _sql+=row;
+    _stmtRows++;
+    _rowCnt++;
+    return ok;
+}
+
+bool BatchInsert::flush()
+{
+    if(_stmtRows>0)
+    {
+        sendStatement();
+    }
+    bool ok=!_failed;
+    _failed=false;
+    return ok;
+}
+
+bool BatchInsert::sendStatement()
+{
+    bool ok=_conn->update(_sql);
+    if(ok)
+    {
+        _affectedRows+=_conn->affectedRows();
+    }
+    else
+    {
+        _errors.push_back({_stmtFirstRow,_stmtRows,_conn->errNo(),_conn->error()});
+        _failed=true;
+    }
+    _sql.clear();
+    _stmtRows=0;
+    return ok;
+}
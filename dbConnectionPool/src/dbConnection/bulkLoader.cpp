@@ -0,0 +1,242 @@
+#include"bulkLoader.hpp"
+#include"connection.hpp"
+#include<thread>
+#include<cstring>
+
+void BulkChunk::addField(string_view value)
+{
+    if(!_rowStart)
+    {
+        _data+='\t';
+    }
+    _rowStart=false;
+    for(char c:value)
+    {
+        switch(c)
+        {
+        case '\\':
+            _data+="\\\\";
+            break;
+        case '\t':
+            _data+="\\t";
+            break;
+        case '\n':
+            _data+="\\n";
+            break;
+        case '\r':
+            _data+="\\r";
+            break;
+        case '\0':
+            _data+="\\0";
+            break;
+        default:
+            _data+=c;
+        }
+    }
+}
+
+void BulkChunk::addNull()
+{
+    if(!_rowStart)
+    {
+        _data+='\t';
+    }
+    _rowStart=false;
+    _data+="\\N";
+}
+
+void BulkChunk::endRow()
+{
+    _data+='\n';
+    _rowStart=true;
+    _rows++;
+}
+
+void BulkChunk::addRow(const vector<string>& values)
+{
+    for(const string& value:values)
+    {
+        addField(value);
+    }
+    endRow();
+}
+
+void BulkChunk::reset()
+{
+    _data.clear();
+    _rows=0;
+    _rowStart=true;
+}
+
+//用反引号引用标识符，标识符中的反引号写两遍
+static string quoteIdentifier(const string& name)
+{
+    string quoted="`";
+    for(char c:name)
+    {
+        if(c=='`')
+        {
+            quoted+='`';
+        }
+        quoted+=c;
+    }
+    quoted+='`';
+    return quoted;
+}
+
+BulkLoader::BulkLoader(Connection* conn,const string& table,const vector<string>& columns,
+                    size_t chunkBytes,size_t maxChunks)
+    :_conn(conn),_chunkBytes(max<size_t>(1,chunkBytes)),_maxChunks(max<size_t>(1,maxChunks)),
+    _produceDone(false),_cancel(false),_offset(0),_producedRows(0),_affectedRows(0)
+{
+    //表名可以带库名前缀，库名和表名分别引用
+    size_t dot=table.find('.');
+    string quotedTable=dot==string::npos?quoteIdentifier(table):
+        quoteIdentifier(table.substr(0,dot))+"."+quoteIdentifier(table.substr(dot+1));
+    //文件名只是占位，数据由回调提供；不指定字符集时服务器按character_set_database解码数据
+    _sql="load data local infile 'bulk_loader' into table "+quotedTable+
+        " character set "+string(conn->charset())+
+        " fields terminated by '\\t' escaped by '\\\\' lines terminated by '\\n'";
+    if(!columns.empty())
+    {
+        _sql+=" (";
+        for(size_t i=0;i<columns.size();i++)
+        {
+            if(i>0)
+            {
+                _sql+=",";
+            }
+            _sql+=quoteIdentifier(columns[i]);
+        }
+        _sql+=")";
+    }
+}
+
+bool BulkLoader::load(const BulkProducer& producer)
+{
+    {
+        lock_guard<mutex> lock(_mtx);
+        _queue.clear();
+        _produceDone=false;
+        _cancel=false;
+    }
+    _current.reset();
+    _offset=0;
+    _producedRows=0;
+    _affectedRows=0;
+
+    thread produce(&BulkLoader::produceTask,this,cref(producer));
+    mysql_set_local_infile_handler(_conn->_conn,infileInit,infileRead,infileEnd,infileError,this);
+    bool ok=_conn->update(_sql);
+    mysql_set_local_infile_default(_conn->_conn);
+    if(ok)
+    {
+        _affectedRows=_conn->affectedRows();
+    }
+    //服务器拒绝了LOCAL INFILE或者中途出错时，让生产者停下来
+    {
+        lock_guard<mutex> lock(_mtx);
+        _cancel=true;
+    }
+    _cv.notify_all();
+    produce.join();
+    return ok;
+}
+
+void BulkLoader::produceTask(const BulkProducer& producer)
+{
+    bool more=true;
+    while(more)
+    {
+        BulkChunk chunk;
+        {
+            unique_lock<mutex> lock(_mtx);
+            _cv.wait(lock,[this](){return _cancel||_queue.size()<_maxChunks;});
+            if(_cancel)
+            {
+                return;
+            }
+            if(!_free.empty())
+            {
+                chunk=move(_free.back());
+                _free.pop_back();
+            }
+        }
+        //生成数据不持有锁，发送线程同时在发送上一块
+        chunk.reset();
+        while(chunk.bytes()<_chunkBytes&&(more=producer(chunk)))
+        {
+        }
+        _producedRows+=chunk.rows();
+        {
+            lock_guard<mutex> lock(_mtx);
+            if(chunk.bytes()>0)
+            {
+                _queue.push_back(move(chunk));
+            }
+            if(!more)
+            {
+                _produceDone=true;
+            }
+        }
+        _cv.notify_all();
+    }
+}
+
+bool BulkLoader::nextChunk()
+{
+    unique_lock<mutex> lock(_mtx);
+    if(_current._data.capacity()>0)
+    {
+        _free.push_back(move(_current));
+    }
+    _current.reset();
+    _offset=0;
+    _cv.notify_all();
+    _cv.wait(lock,[this](){return !_queue.empty()||_produceDone;});
+    if(_queue.empty())
+    {
+        return false;
+    }
+    _current=move(_queue.front());
+    _queue.pop_front();
+    _cv.notify_all();
+    return true;
+}
+
+int BulkLoader::infileInit(void** ptr,const char*,void* userdata)
+{
+    *ptr=userdata;
+    return 0;
+}
+
+int BulkLoader::infileRead(void* ptr,char* buf,unsigned int len)
+{
+    BulkLoader* loader=static_cast<BulkLoader*>(ptr);
+    //当前块发送完后取下一块，返回0表示文件结束
+    while(loader->_offset>=loader->_current.bytes())
+    {
+        if(!loader->nextChunk())
+        {
+            return 0;
+        }
+    }
+    size_t num=min<size_t>(len,loader->_current.bytes()-loader->_offset);
+    memcpy(buf,loader->_current._data.data()+loader->_offset,num);
+    loader->_offset+=num;
+    return num;
+}
+
+void BulkLoader::infileEnd(void*)
+{
+}
+
+int BulkLoader::infileError(void*,char* msg,unsigned int len)
+{
+    //回调本身不会失败，错误都来自服务器
+    if(len>0)
+    {
+        msg[0]='\0';
+    }
+    return 0;
+}
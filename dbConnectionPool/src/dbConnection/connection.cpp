@@ -1,10 +1,19 @@
 #include"connection.hpp"
+#include"batchInsert.hpp"
+#include<algorithm>
 
-Connection::Connection(){
+Connection::Connection():_stmtCacheSize(64),_maxAllowedPacket(0),_multiStatements(false),_broken(false),
+    _wheelPrev(nullptr),_wheelNext(nullptr),_wheelSlot(-1),_expireTick(0),_activeResult(nullptr),_queryCache(nullptr),
+    _fillCache(true),_txnWrite(false),_txnWriteAll(false){
     _conn=mysql_init(nullptr);
+    _retireTime=chrono::steady_clock::time_point::max();
 };
 Connection::~Connection()
 {
+    closeResult();
+    //预处理语句必须在连接关闭前释放
+    _stmtIndex.clear();
+    _stmtLru.clear();
     if(_conn)
         mysql_close(_conn);
 }
@@ -20,7 +29,7 @@ bool Connection::connect(string ip,unsigned short port,
         passwd.c_str(),
         dbname.c_str(),
         port,
-        nullptr,0
+        nullptr,_multiStatements?CLIENT_MULTI_STATEMENTS:0
     );
     if(!p)
     {
@@ -29,15 +38,46 @@ bool Connection::connect(string ip,unsigned short port,
         return false;
     }
 
-    mysql_query(_conn,"set names gbk");
+    //与set names gbk效果相同，同时让客户端库记录连接的字符集，转义和LOAD DATA都按这个字符集进行
+    mysql_set_character_set(_conn,"gbk");
+    _createTime=chrono::steady_clock::now();
+    refreshValidTime();
     // LOG("数据库连接成功！");
     return true;
 
 }
 
+void Connection::setLocalInfile(bool on)
+{
+    unsigned int value=on?1:0;
+    mysql_options(_conn,MYSQL_OPT_LOCAL_INFILE,&value);
+}
+
+void Connection::setConnectTimeout(unsigned int seconds)
+{
+    mysql_options(_conn,MYSQL_OPT_CONNECT_TIMEOUT,&seconds);
+}
+
+bool Connection::ping()
+{
+    closeResult();
+    if(mysql_ping(_conn)!=0)
+    {
+        LOG("连接已失效！");
+        LOG("错误信息:"+string(mysql_error(_conn))+"\n");
+        return false;
+    }
+    refreshValidTime();
+    return true;
+}
+
 bool Connection::update(string sql)
 {
-    if(mysql_query(_conn,sql.c_str()))
+    closeResult();
+    bool ok=mysql_query(_conn,sql.c_str())==0;
+    //失败的语句也可能已经修改了部分数据（例如多行插入中途出错），同样需要失效缓存
+    afterStatement(sql,_multiStatements);
+    if(!ok)
     {
         LOG("更新失败！");
         LOG("错误信息："+string(mysql_error(_conn))+"\n");
@@ -47,13 +87,294 @@ bool Connection::update(string sql)
     return true;
 }
 
-MYSQL_RES* Connection::query(string sql)
+ResultSet Connection::query(string sql)
 {
+    closeResult();
+    if(mysql_query(_conn,sql.c_str()))
+    {
+        LOG("查询失败！");
+        LOG("错误信息："+string(mysql_error(_conn))+"\n");
+        return ResultSet();
+    }
+    return ResultSet(this,mysql_use_result(_conn));
+}
+
+shared_ptr<const CachedResult> Connection::cachedQuery(const string& sql,int ttlMs)
+{
+    string normalized=QueryCache::normalize(sql);
+    //事务中的查询能看到本事务还没有提交的修改，也可能读的是事务开始时的快照，既不读也不写共享的缓存
+    //同一条sql在不同的当前数据库上读的是不同的表，没有选择数据库的连接不使用缓存
+    bool useCache=_queryCache!=nullptr&&_conn->db!=nullptr&&!inTransaction()&&QueryCache::cacheable(normalized);
+    //客户端库在select_db和服务器报告的USE之后更新db，缓存键带上当前数据库
+    string key=useCache?string(_conn->db)+'\0'+normalized:string();
+    vector<string> tables;
+    uint64_t version=0;
+    if(useCache)
+    {
+        shared_ptr<const CachedResult> cached=_queryCache->get(key);
+        if(cached!=nullptr)
+        {
+            return cached;
+        }
+        tables=QueryCache::readTables(normalized);
+        //解析不出读取的表时无法按表失效，不放入缓存
+        useCache=_fillCache&&!tables.empty();
+        //必须在查询之前取版本号，查询期间有写入时put会丢弃这次的结果
+        version=_queryCache->version();
+    }
+
+    closeResult();
     if(mysql_query(_conn,sql.c_str()))
     {
         LOG("查询失败！");
         LOG("错误信息："+string(mysql_error(_conn))+"\n");
         return nullptr;
     }
-    return mysql_use_result(_conn);
-}
\ No newline at end of file
+    MYSQL_RES* res=mysql_store_result(_conn);
+    if(res==nullptr)
+    {
+        return nullptr;
+    }
+    shared_ptr<CachedResult> result=make_shared<CachedResult>();
+    unsigned int fieldNum=mysql_num_fields(res);
+    MYSQL_FIELD* fields=mysql_fetch_fields(res);
+    for(unsigned int i=0;i<fieldNum;i++)
+    {
+        result->fieldNames.emplace_back(fields[i].name);
+    }
+    MYSQL_ROW row;
+    while((row=mysql_fetch_row(res))!=nullptr)
+    {
+        unsigned long* lengths=mysql_fetch_lengths(res);
+        vector<string> values;
+        values.reserve(fieldNum);
+        for(unsigned int i=0;i<fieldNum;i++)
+        {
+            values.emplace_back(row[i]?string(row[i],lengths[i]):string());
+        }
+        result->rows.push_back(move(values));
+    }
+    mysql_free_result(res);
+
+    //关闭了autocommit时查询本身会开启事务，同样不放入缓存
+    if(useCache&&!inTransaction())
+    {
+        _queryCache->put(key,tables,result,version,ttlMs);
+    }
+    return result;
+}
+
+void Connection::afterStatement(const string& sql,bool multiStatements)
+{
+    if(_queryCache==nullptr)
+    {
+        return;
+    }
+    vector<string> tables;
+    if(QueryCache::writeTargets(sql,tables,multiStatements))
+    {
+        _queryCache->invalidateTables(tables);
+        if(inTransaction())
+        {
+            _txnWrite=true;
+            _txnWriteAll=_txnWriteAll||tables.empty();
+            for(const string& table:tables)
+            {
+                if(find(_txnTables.begin(),_txnTables.end(),table)==_txnTables.end())
+                {
+                    _txnTables.push_back(table);
+                }
+            }
+        }
+    }
+    //事务已经提交、回滚或者被隐式提交，事务进行期间其他连接可能把修改之前的数据放进了缓存，再失效一次
+    if(_txnWrite&&!inTransaction())
+    {
+        _queryCache->invalidateTables(_txnWriteAll?vector<string>():_txnTables);
+        _txnTables.clear();
+        _txnWrite=false;
+        _txnWriteAll=false;
+    }
+}
+
+void Connection::closeResult()
+{
+    if(_activeResult!=nullptr)
+    {
+        _activeResult->close();
+    }
+}
+
+PreparedStatement* Connection::prepare(const string& sql)
+{
+    closeResult();
+    auto it=_stmtIndex.find(sql);
+    if(it!=_stmtIndex.end())
+    {
+        //命中，移到链表头部
+        _stmtLru.splice(_stmtLru.begin(),_stmtLru,it->second);
+        return it->second->second.get();
+    }
+
+    unique_ptr<PreparedStatement> stmt(new PreparedStatement(this,_conn));
+    if(!stmt->prepare(sql))
+    {
+        return nullptr;
+    }
+    if(_stmtCacheSize==0)
+    {
+        //不缓存时只保留最近一条语句
+        _stmtIndex.clear();
+        _stmtLru.clear();
+    }
+    else if(_stmtLru.size()>=_stmtCacheSize)
+    {
+        //淘汰最久未使用的语句，析构时关闭服务器端的语句句柄
+        _stmtIndex.erase(_stmtLru.back().first);
+        _stmtLru.pop_back();
+    }
+    _stmtLru.emplace_front(sql,move(stmt));
+    _stmtIndex[sql]=_stmtLru.begin();
+    return _stmtLru.front().second.get();
+}
+
+bool Connection::pipeline(const vector<string>& stmts,vector<PipelineResult>& results)
+{
+    closeResult();
+    results.assign(stmts.size(),PipelineResult());
+    if(stmts.empty())
+    {
+        return true;
+    }
+    string sql;
+    for(const string& stmt:stmts)
+    {
+        //去掉语句末尾的分号和空白，统一用分号分隔
+        size_t end=stmt.find_last_not_of("; \t\r\n");
+        if(!sql.empty())
+        {
+            sql+=";";
+        }
+        sql.append(stmt,0,end==string::npos?0:end+1);
+    }
+
+    if(!_multiStatements&&mysql_set_server_option(_conn,MYSQL_OPTION_MULTI_STATEMENTS_ON))
+    {
+        LOG("打开多语句选项失败！");
+        LOG("错误信息："+string(mysql_error(_conn))+"\n");
+        return false;
+    }
+
+    bool allOk=true;
+    size_t idx=0;
+    int status=mysql_real_query(_conn,sql.c_str(),sql.size());
+    while(idx<results.size())
+    {
+        PipelineResult& result=results[idx++];
+        result.executed=true;
+        if(status!=0)
+        {
+            //当前语句出错，服务器不会再执行后面的语句
+            result.errNo=mysql_errno(_conn);
+            result.error=mysql_error(_conn);
+            LOG("第"+to_string(idx)+"条语句执行失败！");
+            LOG("错误信息："+result.error+"\n");
+            allOk=false;
+            break;
+        }
+
+        MYSQL_RES* res=mysql_store_result(_conn);
+        if(res!=nullptr)
+        {
+            unsigned int fieldNum=mysql_num_fields(res);
+            MYSQL_ROW row;
+            while((row=mysql_fetch_row(res))!=nullptr)
+            {
+                unsigned long* lengths=mysql_fetch_lengths(res);
+                vector<string> fields;
+                fields.reserve(fieldNum);
+                for(unsigned int i=0;i<fieldNum;i++)
+                {
+                    fields.emplace_back(row[i]?string(row[i],lengths[i]):string());
+                }
+                result.rows.push_back(move(fields));
+            }
+            mysql_free_result(res);
+            result.ok=true;
+        }
+        else if(mysql_field_count(_conn)==0)
+        {
+            result.affectedRows=mysql_affected_rows(_conn);
+            result.ok=true;
+        }
+        else
+        {
+            //有结果集但读取失败
+            result.errNo=mysql_errno(_conn);
+            result.error=mysql_error(_conn);
+            allOk=false;
+        }
+
+        //0表示还有下一条语句的结果，-1表示没有更多结果，大于0表示下一条语句出错
+        status=mysql_next_result(_conn);
+        if(status==-1)
+        {
+            break;
+        }
+    }
+    //语句里自带分号时结果数会多于stmts，把多出的结果取完，保证连接可以继续使用
+    while(status==0)
+    {
+        mysql_free_result(mysql_store_result(_conn));
+        status=mysql_next_result(_conn);
+    }
+
+    if(!_multiStatements)
+    {
+        mysql_set_server_option(_conn,MYSQL_OPTION_MULTI_STATEMENTS_OFF);
+    }
+    for(const string& stmt:stmts)
+    {
+        afterStatement(stmt,true);
+    }
+    return allOk;
+}
+
+BatchInsert Connection::insertBatch(const string& insertHead)
+{
+    return BatchInsert(this,insertHead);
+}
+
+string Connection::escape(const string& str)
+{
+    string result(str.size()*2+1,'\0');
+    unsigned long len=mysql_real_escape_string(_conn,&result[0],str.c_str(),str.size());
+    result.resize(len);
+    return result;
+}
+
+size_t Connection::maxAllowedPacket()
+{
+    if(_maxAllowedPacket>0)
+    {
+        return _maxAllowedPacket;
+    }
+    //连接上可能还有没有读完的流式结果集，先关闭它，否则查询会因为命令不同步而失败
+    closeResult();
+    //查询失败时按MySQL 5.7的默认值4MB处理
+    _maxAllowedPacket=4*1024*1024;
+    if(mysql_query(_conn,"select @@max_allowed_packet")==0)
+    {
+        MYSQL_RES* res=mysql_store_result(_conn);
+        if(res!=nullptr)
+        {
+            MYSQL_ROW row=mysql_fetch_row(res);
+            if(row!=nullptr&&row[0]!=nullptr)
+            {
+                _maxAllowedPacket=strtoull(row[0],nullptr,10);
+            }
+            mysql_free_result(res);
+        }
+    }
+    return _maxAllowedPacket;
+}
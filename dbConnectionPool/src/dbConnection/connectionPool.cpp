@@ -2,20 +2,59 @@
 #include"public.hpp"
 #include<fstream>
 #include<unistd.h>
+#include<sched.h>
+#include<vector>
+#include<cmath>
+#include<algorithm>
+#include<random>
+#include<unordered_map>
 
 ConnectionPool* ConnectionPool::getConnectionPool()
 {
-    static ConnectionPool  pool;
-    return &pool;
+    return getConnectionPool(DEFAULT_POOL);
 }
 
-bool ConnectionPool::loadConfigFile()
+ConnectionPool* ConnectionPool::getConnectionPool(const string& name)
+{
+    //连接池的后台线程是分离的，会一直运行到进程结束，
+    //因此连接池不能在静态析构阶段被销毁，否则析构条件变量时会一直等待阻塞在上面的后台线程
+    static mutex registryMutex;
+    static unordered_map<string,ConnectionPool*> pools;
+    lock_guard<mutex> lock(registryMutex);
+    auto it=pools.find(name);
+    if(it!=pools.end())
+    {
+        return it->second;
+    }
+    if(name!=DEFAULT_POOL)
+    {
+        vector<string> names=getPoolNames();
+        if(find(names.begin(),names.end(),name)==names.end())
+        {
+            LOG("mysql.cnf中没有连接池"+name+"的配置段！");
+            return nullptr;
+        }
+    }
+    ConnectionPool* pool=new ConnectionPool(name,"",0);
+    if(!pool->started())
+    {
+        //没有启动的连接池没有分片和后台线程，可以直接销毁
+        LOG("连接池"+name+"加载配置失败！");
+        delete pool;
+        return nullptr;
+    }
+    pools[name]=pool;
+    return pool;
+}
+
+//配置文件conf/mysql.cnf，conf目录与当前工作目录（bin）同级
+static FILE* openConfigFile()
 {
     char path[1024];
     if (getcwd(path, sizeof(path)) == NULL)
     {
         LOG("Failed to get current working directory!");
-        return false;
+        return nullptr;
     }
     //获取项目根目录
     string fullPath=string(path);
@@ -25,14 +64,66 @@ bool ConnectionPool::loadConfigFile()
     if(!fp)
     {
         LOG("./mysql.cnf file is not exist!");
+    }
+    return fp;
+}
+
+//配置段的名称，不是配置段标题的行返回空串
+static string sectionName(const string& line)
+{
+    if(line.empty()||line[0]!='[')
+    {
+        return "";
+    }
+    size_t end=line.find(']');
+    return end==string::npos?"":line.substr(1,end-1);
+}
+
+vector<string> ConnectionPool::getPoolNames()
+{
+    vector<string> names={DEFAULT_POOL};
+    FILE* fp=openConfigFile();
+    if(!fp)
+    {
+        return names;
+    }
+    char line[1024];
+    while(fgets(line,1024,fp)!=nullptr)
+    {
+        string name=sectionName(line);
+        if(!name.empty()&&find(names.begin(),names.end(),name)==names.end())
+        {
+            names.push_back(name);
+        }
+    }
+    fclose(fp);
+    return names;
+}
+
+bool ConnectionPool::loadConfigFile()
+{
+    FILE* fp=openConfigFile();
+    if(!fp)
+    {
         return false;
     }
 
+    //配置段之前的配置项是所有连接池的默认值，[name]配置段中的配置项只对名为name的连接池生效
+    string section;
     while(!feof(fp))//feof用于检测释放读取到文件尾
     {
         char line[1024]={0};
         fgets(line,1024,fp);//读取一行数据
         string str=line;
+        if(str[0]=='[')
+        {
+            section=sectionName(str);
+            continue;
+        }
+        if(!section.empty()&&section!=_name)
+        {
+            continue;
+        }
         int idx=str.find("=");
         if(idx==-1)//无效配置项
         {
@@ -61,6 +152,25 @@ bool ConnectionPool::loadConfigFile()
         {
             _dbname=value;
         }
+        if(key=="replicas")
+        {
+            //逗号分隔的ip:port列表
+            _replicas.clear();
+            size_t begin=0;
+            while(begin<value.size())
+            {
+                size_t end=value.find(',',begin);
+                if(end==string::npos)
+                {
+                    end=value.size();
+                }
+                if(end>begin)
+                {
+                    _replicas.push_back(value.substr(begin,end-begin));
+                }
+                begin=end+1;
+            }
+        }
         if(key=="initSize")
         {
             _initSize=atoi(value.c_str());
@@ -77,27 +187,140 @@ bool ConnectionPool::loadConfigFile()
         {
             _connectionTimeout=atoi(value.c_str());
         }
+        if(key=="shardNum")
+        {
+            _shardNum=atoi(value.c_str());
+        }
+        if(key=="warmupConcurrency")
+        {
+            _warmupConcurrency=atoi(value.c_str());
+        }
+        if(key=="stmtCacheSize")
+        {
+            _stmtCacheSize=atoi(value.c_str());
+        }
+        if(key=="multiStatements")
+        {
+            _multiStatements=atoi(value.c_str())!=0;
+        }
+        if(key=="localInfile")
+        {
+            _localInfile=atoi(value.c_str())!=0;
+        }
+        if(key=="queryCacheSize")
+        {
+            _queryCacheSize=strtoull(value.c_str(),nullptr,10);
+        }
+        if(key=="queryCacheTtl")
+        {
+            _queryCacheTtl=atoi(value.c_str());
+        }
+        if(key=="validationThreshold")
+        {
+            _validationThreshold=atoi(value.c_str());
+        }
+        if(key=="keepaliveInterval")
+        {
+            _keepaliveInterval=atoi(value.c_str());
+        }
+        if(key=="threadCacheIdle")
+        {
+            _threadCacheIdle=atoi(value.c_str());
+        }
+        if(key=="maxLifetime")
+        {
+            _maxLifetime=atoi(value.c_str());
+        }
+        if(key=="lifetimeJitter")
+        {
+            _lifetimeJitter=atoi(value.c_str());
+        }
+        if(key=="connectTimeout")
+        {
+            _connectTimeout=atoi(value.c_str());
+        }
+        if(key=="connectBackoffMin")
+        {
+            _backoffMin=atoi(value.c_str());
+        }
+        if(key=="connectBackoffMax")
+        {
+            _backoffMax=atoi(value.c_str());
+        }
+        if(key=="breakerThreshold")
+        {
+            _breakerThreshold=atoi(value.c_str());
+        }
+        if(key=="sizingInterval")
+        {
+            _sizingInterval=atoi(value.c_str());
+        }
+        if(key=="sizingHeadroom")
+        {
+            _sizingHeadroom=atoi(value.c_str());
+        }
+        if(key=="growWaitThreshold")
+        {
+            _growWaitThreshold=atoi(value.c_str());
+        }
+        if(key=="shrinkHysteresis")
+        {
+            _shrinkHysteresis=atoi(value.c_str());
+        }
+        if(key=="shrinkDelay")
+        {
+            _shrinkDelay=atoi(value.c_str());
+        }
     }
+    fclose(fp);
     return true;
 }
 
 
-ConnectionPool::ConnectionPool()
+ConnectionPool::ConnectionPool(const string& name,const string& ip,unsigned short port,QueryCache* sharedQueryCache)
+    :_name(name),_shardNum(0),_warmupConcurrency(8),_stmtCacheSize(64),_multiStatements(false),_localInfile(false),
+    _queryCacheSize(0),_queryCacheTtl(1000),_sharedQueryCache(sharedQueryCache),_validationThreshold(30000),
+    _keepaliveInterval(60000),_sizingInterval(1000),_sizingHeadroom(20),
+    _growWaitThreshold(10),_shrinkHysteresis(25),_shrinkDelay(3),_threadCacheIdle(0),
+    _spilling(false),_releasedSlotHits(0),_maxLifetime(1800),_lifetimeJitter(10),
+    _connectTimeout(0),_backoffMin(100),_backoffMax(10000),_breakerThreshold(5),_connectFailStreak(0),_breakerOpen(false),
+    _spareCnt(0),_spareRequest(0),_idleCnt(0),_connectionCnt(0),_waiterCnt(0),
+    _waitHead(nullptr),_waitTail(nullptr),_targetSize(0),_timeoutCnt(0),_rejectCnt(0),_connectFailCnt(0),_closedCnt(0),
+    _warmedCnt(0),_warmupDone(false),_started(false)
 {
     if(!loadConfigFile())//加载配置项
     {
         return;
     }
-    //初始化连接池的连接
-    for(int i=0;i<_initSize;i++)
+    if(!ip.empty())
+    {
+        _ip=ip;
+        _port=port;
+        //其它实例的连接池自己不再有从库
+        _replicas.clear();
+    }
+    start();
+    _started=true;
+}
+
+void ConnectionPool::start()
+{
+    _targetSize=_initSize;
+    _wheelEpoch=chrono::steady_clock::now();
+    if(_shardNum<=0)
+    {
+        _shardNum=max(1u,thread::hardware_concurrency());
+    }
+    _shards=makeAlignedArray<IdleShard>(_shardNum);
+    if(_queryCacheSize>0&&_sharedQueryCache==nullptr)
     {
-        Connection* connPtr=new Connection();
-        connPtr->connect(_ip,_port,_user,_passwd,_dbname);
-        //刷新连接空闲时间初始点
-        connPtr->refreshAliveTime();
-        _connectionQue.push(connPtr)    ;
-        _connectionCnt++;
+        _queryCache.reset(new QueryCache(_queryCacheSize,_queryCacheTtl));
     }
+
+    //初始连接在后台并发建立，构造函数不再等待initSize次串行的连接握手
+    thread warmup(&ConnectionPool::warmupConnectionTask,this);
+    warmup.detach();
+
     //连接生产线程
     thread produce(&ConnectionPool::produceConnectionTask,this);
     produce.detach();
@@ -105,97 +328,1257 @@ ConnectionPool::ConnectionPool()
     //监督线程，监督队列中空闲线程，如果队列中存在空闲时间过久的连接，就直接释放
     thread scanner(&ConnectionPool::scannerConnectionTask,this);
     scanner.detach();
+
+    //保活线程，在借出之前发现并替换被服务器断开的空闲连接
+    if(_keepaliveInterval>0)
+    {
+        thread keepalive(&ConnectionPool::keepaliveConnectionTask,this);
+        keepalive.detach();
+    }
+
+    //连接数控制线程，根据负载提前扩容、在空闲时尽快缩容
+    if(_sizingInterval>0)
+    {
+        thread controller(&ConnectionPool::sizingControllerTask,this);
+        controller.detach();
+    }
 }
 
-//链接生产线程
-void ConnectionPool::produceConnectionTask()
+Connection* ConnectionPool::newConnection()
 {
-    while(1)
+    Connection* connPtr=new Connection();
+    connPtr->setStmtCacheSize(_stmtCacheSize);
+    connPtr->setMultiStatements(_multiStatements);
+    if(_localInfile)
+    {
+        connPtr->setLocalInfile(true);
+    }
+    if(_connectTimeout>0)
+    {
+        connPtr->setConnectTimeout(_connectTimeout);
+    }
+    connPtr->setQueryCache(getQueryCache(),_sharedQueryCache==nullptr);
+    return connPtr;
+}
+
+int ConnectionPool::createConnections(int num,const function<void()>& onCreated)
+{
+    atomic_int next(0);
+    atomic_int created(0);
+    int workerNum=min(max(1,_warmupConcurrency),max(1,num));
+    vector<thread> workers;
+    for(int i=0;i<workerNum;i++)
     {
-        unique_lock<mutex> lock(_queueMutex);
-        while(!_connectionQue.empty())
+        workers.emplace_back([&]()
         {
-            //连接队列不空，阻塞生产者线程，通知消费者线程进行消费
-            cv.wait(lock);
-        }
+            while(next++<num)
+            {
+                Connection* connPtr=newConnection();
+                auto start=chrono::steady_clock::now();
+                if(!connPtr->connect(_ip,_port,_user,_passwd,_dbname))
+                {
+                    _connectFailCnt++;
+                    delete connPtr;
+                    recordConnectResult(false);
+                    continue;
+                }
+                recordConnectResult(true);
+                _connectHist.record(chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now()-start).count());
+                registerConnection(connPtr);
+                _connectionCnt++;
+                created++;
+                //新连接直接放进共享的分片或交给等待者，不经过线程缓存：
+                //放进工作线程自己的缓存槽里，借用者在扫描线程下一个tick之前都拿不到它
+                connPtr->refreshAliveTime();
+                releaseIdleConnection(connPtr);
+                if(onCreated)
+                {
+                    onCreated();
+                }
+            }
+        });
+    }
+    for(auto& worker:workers)
+    {
+        worker.join();
+    }
+    return created;
+}
+
+void ConnectionPool::warmupConnectionTask()
+{
+    createConnections(_initSize,[this]()
+    {
+        lock_guard<mutex> lock(_readyMutex);
+        _warmedCnt++;
+        _readyCv.notify_all();
+    });
+
+    {
+        lock_guard<mutex> lock(_readyMutex);
+        _warmupDone=true;
+        _readyCv.notify_all();
+    }
+    //预热期间生产者不补充连接，预热结束后再按需生产
+    lock_guard<mutex> lock(_waitMutex);
+    _produceCv.notify_one();
+}
+
+bool ConnectionPool::waitReady(int readyNum,int timeoutMs)
+{
+    readyNum=min(readyNum,_initSize);
+    unique_lock<mutex> lock(_readyMutex);
+    _readyCv.wait_for(lock,std::chrono::milliseconds(timeoutMs),[&]()
+    {
+        return _warmedCnt>=readyNum||_warmupDone;
+    });
+    return _warmedCnt>=readyNum;
+}
+
+int ConnectionPool::localShard() const
+{
+    int cpu=sched_getcpu();
+    if(cpu<0)
+    {
+        //不支持sched_getcpu时按线程id散列
+        return hash<thread::id>()(this_thread::get_id())%_shardNum;
+    }
+    return cpu%_shardNum;
+}
 
-        //说明此时队列为空，生产连接
-        if(_connectionCnt<_maxSize)
+Connection* ConnectionPool::takeIdleConnection(bool fastPath)
+{
+    if(_idleCnt.load()==0)
+    {
+        return nullptr;
+    }
+    //先取本地分片，为空再按顺序窃取其它分片，都从队尾取最热的连接
+    int home=localShard();
+    for(int i=0;i<_shardNum;i++)
+    {
+        IdleShard& shard=_shards[(home+i)%_shardNum];
+        lock_guard<mutex> lock(shard.mtx);
+        if(!shard.que.empty())
         {
-            Connection* connPtr=new Connection();
-            connPtr->connect(_ip,_port,_user,_passwd,_dbname);
-            //刷新连接空闲时间初始点
-            connPtr->refreshAliveTime();
-            _connectionQue.push(connPtr)    ;
-            _connectionCnt++;
+            Connection* conn=shard.que.back();
+            shard.que.pop_back();
+            shard.wheel.remove(conn);
+            if(fastPath)
+            {
+                //已经持有分片锁，不需要原子的读-改-写
+                shard.borrowCnt.store(shard.borrowCnt.load(memory_order_relaxed)+1,memory_order_relaxed);
+            }
+            if(--_idleCnt==0)
+            {
+                //连接被取空，通知生产者线程生产新连接
+                _produceCv.notify_one();
+            }
+            return conn;
         }
-        //通知所有消费者线程，队列不为空，可以进行消费
-        cv.notify_all();
     }
+    return nullptr;
 }
 
-shared_ptr<Connection> ConnectionPool::getConnection()
+void ConnectionPool::putIdleConnection(Connection* conn)
 {
-    unique_lock<mutex> lock(_queueMutex);
-    while(_connectionQue.empty())
+    //协议状态被打断的连接不能再借给别人
+    if(conn->broken())
     {
-        //当前链接队列为空，阻塞等待消费者线程个_connectionTimeout的时间
-        if(cv_status::timeout==cv.wait_for(lock,std::chrono::milliseconds(_connectionTimeout)))
+        discardConnection(conn);
+        return;
+    }
+    //使用者没有读完的结果集在这里读完并释放，保证借出的连接协议状态干净
+    conn->closeResult();
+    //刷新连接空闲时间初始点
+    conn->refreshAliveTime();
+    //到了退役时间的连接不再放回连接池，只比较一次时间，不需要再读时钟
+    if(conn->getIdleSince()>=conn->getRetireTime()&&retireConnection(conn))
+    {
+        return;
+    }
+    //最后一条语句执行成功说明连接此时可用，借出时不需要再校验
+    if(conn->errNo()==0)
+    {
+        conn->refreshValidTime();
+    }
+    //没有人等待时留给本线程下次借用；有人等待时不能把连接藏在线程里
+    if(_threadCacheIdle>0&&_waiterCnt.load()==0)
+    {
+        ThreadSlot* slot=localSlot();
+        Connection* empty=nullptr;
+        if(slot->conn.compare_exchange_strong(empty,conn))
         {
-            if(_connectionQue.empty())
+            //放入之前检查过之后可能有线程开始等待，而它在入队后清空线程缓存时可能还没看到这个连接；
+            //放入之后再检查一次，有等待者就取回来交出去（已经被清空线程缓存的一方取走时取回的是空）
+            if(_waiterCnt.load()!=0)
             {
-                LOG("获取空闲时间超时，连接失败！");
-                return nullptr;
+                conn=slot->conn.exchange(nullptr);
+                if(conn!=nullptr)
+                {
+                    releaseIdleConnection(conn);
+                }
             }
+            return;
         }
     }
+    releaseIdleConnection(conn);
+}
+
+void ConnectionPool::releaseIdleConnection(Connection* conn)
+{
+    if(_waiterCnt.load()>0)
+    {
+        //有人在等待，直接把连接交给等待最久的那个，不经过分片，也不会被新来的线程插队
+        lock_guard<mutex> lock(_waitMutex);
+        if(handoffLocked(conn))
+        {
+            return;
+        }
+    }
+    {
+        IdleShard& shard=_shards[localShard()];
+        lock_guard<mutex> lock(shard.mtx);
+        shard.que.push_back(conn);
+        shard.wheel.add(conn,idleExpireTick(conn));
+        _idleCnt++;
+    }
+    //_idleCnt与_waiterCnt都是顺序一致的原子操作，
+    //等待者先增加_waiterCnt再检查分片，这里先放入分片再检查_waiterCnt，二者至少有一方能看到对方
+    if(_waiterCnt.load()>0)
+    {
+        lock_guard<mutex> lock(_waitMutex);
+        drainIdleToWaitersLocked();
+    }
+}
+
+void ConnectionPool::enqueueWaiter(ConnectionWaiter* waiter)
+{
+    waiter->prev=_waitTail;
+    waiter->next=nullptr;
+    if(_waitTail!=nullptr)
+    {
+        _waitTail->next=waiter;
+    }
+    else
+    {
+        _waitHead=waiter;
+    }
+    _waitTail=waiter;
+    _waiterCnt++;
+}
+
+void ConnectionPool::removeWaiter(ConnectionWaiter* waiter)
+{
+    if(waiter->prev!=nullptr)
+    {
+        waiter->prev->next=waiter->next;
+    }
+    else
+    {
+        _waitHead=waiter->next;
+    }
+    if(waiter->next!=nullptr)
+    {
+        waiter->next->prev=waiter->prev;
+    }
+    else
+    {
+        _waitTail=waiter->prev;
+    }
+    waiter->prev=waiter->next=nullptr;
+    _waiterCnt--;
+}
+
+bool ConnectionPool::handoffLocked(Connection* conn)
+{
+    ConnectionWaiter* waiter=_waitHead;
+    if(waiter==nullptr)
+    {
+        return false;
+    }
+    removeWaiter(waiter);
+    waiter->conn=conn;
+    if(waiter->callback)
+    {
+        //异步等待者的回调不能在持有_waitMutex时执行，交给异步线程完成
+        _asyncTimers.erase(waiter->timer);
+        _asyncDone.push_back(waiter);
+        _asyncCv.notify_one();
+    }
+    else
+    {
+        waiter->cv.notify_one();
+    }
+    return true;
+}
 
-    //从连接队列中获取一个连接对象,
-    //并自定义删除器，当使用完连接后不释放连接，而是将其刚入连接池中
-    shared_ptr<Connection> connPtr(
-        _connectionQue.front(),
-        [&](Connection* cp)
+void ConnectionPool::drainIdleToWaitersLocked()
+{
+    while(_waitHead!=nullptr)
+    {
+        Connection* conn=takeIdleConnection();
+        if(conn==nullptr)
         {
-            //删除器是在服务器线程中调用的，而不是这段代码调用的，
-            //因此代码最开始的互斥锁在这里不起作用，需要对临界队列进行互斥使用
-            // unique_lock<mutex> lock(_queueMutex);
-            lock_guard<mutex> lock(_queueMutex);
+            return;
+        }
+        handoffLocked(conn);
+    }
+}
 
-            //刷新连接空闲时间初始点
-            cp->refreshAliveTime();
-            _connectionQue.push(cp);
+void ConnectionPool::rejectWaitersLocked()
+{
+    while(_waitHead!=nullptr)
+    {
+        ConnectionWaiter* waiter=_waitHead;
+        removeWaiter(waiter);
+        waiter->rejected=true;
+        if(waiter->callback)
+        {
+            _asyncTimers.erase(waiter->timer);
+            _asyncDone.push_back(waiter);
+            _asyncCv.notify_one();
         }
-    );
-    _connectionQue.pop();
-    //通知消费者线程，如果队列为空就生成线程
-    cv.notify_all();
-    return connPtr;
+        else
+        {
+            waiter->cv.notify_one();
+        }
+    }
 }
 
-void ConnectionPool::scannerConnectionTask()
+//链接生产线程
+void ConnectionPool::produceConnectionTask()
 {
+    //连续一个连接都没有建立成功的轮数，决定退避间隔
+    int failRounds=0;
+    mt19937 rng(random_device{}());
     while(1)
     {
-        //定时清理，每隔一个连接最大空闲时间单位就扫描一次队列，清理队列多余连接
-        this_thread::sleep_for(std::chrono::seconds(_maxIdleTime));
-        unique_lock<mutex> lock(_queueMutex);
-        //扫描整个连接队列，释放对于的连接
-        while(_connectionCnt>_initSize)
+        int num=0;
+        int spares=0;
         {
-            Connection *p=_connectionQue.front();
-            if(p->getAliveTime()>=_maxIdleTime*1000)
+            unique_lock<mutex> lock(_waitMutex);
+            //还在预热，或者连接总数已达上限，或者还有空闲连接、已达到目标连接数且没有替代连接要建立，阻塞生产者线程
+            while(!_warmupDone||_connectionCnt>=_maxSize||
+                (_idleCnt>0&&_connectionCnt>=_targetSize&&_spareRequest==0))
             {
-                _connectionQue.pop();
-                _connectionCnt--;
-                delete p;
+                _produceCv.wait(lock);
+            }
+            //补到目标连接数；连接被取空时至少为每个等待者各建立一个
+            num=_targetSize-_connectionCnt;
+            if(_idleCnt==0)
+            {
+                num=max(num,max(1,_waiterCnt.load()));
             }
-            else{
-            //如果队头的连接空闲时间都没有超过设定的最大空闲时间，
-            //说明队列其他的连接都没有超过空闲时间
-                break;
+            //替代连接在此之外额外建立，旧连接退役后连接数才回到原来的规模
+            spares=min(_spareRequest,_maxSize-_connectionCnt);
+            _spareRequest-=spares;
+            num=min(max(num,0)+spares,_maxSize-_connectionCnt);
+            //退避期间只用一个连接探测数据库是否恢复
+            if(failRounds>0)
+            {
+                num=min(num,1);
             }
         }
+
+        //建立连接时不持有任何锁
+        int created=createConnections(num);
+        //先满足替代连接，没有建立成功的替代请求放回去下次再建
+        int spareCreated=min(created,spares);
+        if(spareCreated>0)
+        {
+            lock_guard<mutex> lock(_rotationMutex);
+            _spareCnt+=spareCreated;
+        }
+        if(spareCreated<spares)
+        {
+            lock_guard<mutex> lock(_waitMutex);
+            _spareRequest+=spares-spareCreated;
+        }
+        if(created==0)
+        {
+            //一个连接都没有建立成功，按指数退避并加随机抖动后再试，避免数据库不可用时空转，也避免多个进程同时重连
+            int backoff=min<long long>(max(1,_backoffMax),(long long)max(1,_backoffMin)<<min(failRounds,20));
+            failRounds++;
+            this_thread::sleep_for(chrono::milliseconds(uniform_int_distribution<int>(backoff/2,backoff)(rng)));
+        }
+        else
+        {
+            failRounds=0;
+        }
+    }
+}
+
+void ConnectionPool::recordConnectResult(bool ok)
+{
+    if(ok)
+    {
+        _connectFailStreak=0;
+        if(_breakerOpen.exchange(false))
+        {
+            LOG("建立连接成功，关闭熔断器！");
+        }
+        return;
+    }
+    if(_breakerThreshold>0&&++_connectFailStreak>=_breakerThreshold&&!_breakerOpen.exchange(true))
+    {
+        LOG("连续"+to_string(_breakerThreshold)+"次建立连接失败，打开熔断器，没有空闲连接时获取连接立即失败！");
+        //已经在等待的线程也不再等到超时
+        lock_guard<mutex> lock(_waitMutex);
+        rejectWaitersLocked();
     }
 }
 
+PooledConnection ConnectionPool::getConnection()
+{
+    Connection* conn=nullptr;
+    //第一次进入慢路径时才读取时钟，快速路径上没有计时开销
+    bool waited=false;
+    chrono::steady_clock::time_point start;
+    chrono::steady_clock::time_point deadline;
+    while(conn==nullptr)
+    {
+        //最快路径：本线程上次归还的连接还在缓存槽中，只需要一次无竞争的原子交换
+        if(_threadCacheIdle>0)
+        {
+            conn=takeCachedConnection();
+        }
+        //快速路径：只锁住一个分片；已有线程在排队时不插队
+        if(conn==nullptr&&_waiterCnt.load()==0)
+        {
+            conn=takeIdleConnection(true);
+        }
+        if(conn==nullptr)
+        {
+            //从第一次进入慢路径开始计算截止时间，伪唤醒和校验失败后的重试都不会延长总的等待时间
+            //熔断器打开时数据库很可能不可用，不再等待生产者建立连接
+            if(_breakerOpen.load())
+            {
+                _rejectCnt++;
+                LOG("熔断器打开，获取连接失败！");
+                return PooledConnection();
+            }
+            if(!waited)
+            {
+                waited=true;
+                start=chrono::steady_clock::now();
+                deadline=start+chrono::milliseconds(_connectionTimeout);
+            }
+            ConnectionWaiter waiter;
+            unique_lock<mutex> lock(_waitMutex);
+            enqueueWaiter(&waiter);
+            _produceCv.notify_one();
+            //入队之后其它线程缓存中闲着的连接才会按顺序交给等待者，清空时会获取_waitMutex
+            if(_threadCacheIdle>0)
+            {
+                lock.unlock();
+                spillForWaiters();
+                lock.lock();
+            }
+            //入队前可能刚好有连接被放回分片，按先后顺序交给队列中的等待者
+            drainIdleToWaitersLocked();
+            while(waiter.conn==nullptr&&!waiter.rejected)
+            {
+                if(waiter.cv.wait_until(lock,deadline)==cv_status::timeout&&waiter.conn==nullptr&&!waiter.rejected)
+                {
+                    removeWaiter(&waiter);
+                    lock.unlock();
+                    _timeoutCnt++;
+                    _waitHist.record(chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now()-start).count());
+                    LOG("获取空闲时间超时，连接失败！");
+                    return PooledConnection();
+                }
+            }
+            //交接连接或者打开熔断器的一方已经把等待者移出队列
+            if(waiter.rejected)
+            {
+                lock.unlock();
+                _rejectCnt++;
+                LOG("熔断器打开，获取连接失败！");
+                return PooledConnection();
+            }
+            conn=waiter.conn;
+        }
+        //空闲过久的连接可能已被服务器断开，校验失败的连接已被关闭，重新获取
+        if(!validateConnection(conn))
+        {
+            conn=nullptr;
+        }
+    }
+    //快速路径的借用已经在分片中计数，只有等待过的借用记录等待时间
+    if(waited)
+    {
+        _waitHist.record(chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now()-start).count());
+    }
+
+    //PooledConnection析构时不释放连接，而是将其放回归还线程所在CPU的分片中
+    return PooledConnection(this,conn);
+}
 
+void ConnectionPool::getConnectionAsync(AcquireCallback callback,ConnectionExecutor executor,int timeoutMs)
+{
+    ConnectionWaiter* waiter=new ConnectionWaiter();
+    waiter->callback=move(callback);
+    waiter->executor=move(executor);
+    waiter->start=chrono::steady_clock::now();
+    waiter->deadline=waiter->start+chrono::milliseconds(timeoutMs<0?_connectionTimeout:timeoutMs);
+    acquireAsync(waiter);
+}
+
+future<PooledConnection> ConnectionPool::getConnectionAsync(int timeoutMs)
+{
+    shared_ptr<promise<PooledConnection>> prom=make_shared<promise<PooledConnection>>();
+    future<PooledConnection> fut=prom->get_future();
+    getConnectionAsync([prom](PooledConnection conn)
+    {
+        prom->set_value(move(conn));
+    },nullptr,timeoutMs);
+    return fut;
+}
+
+void ConnectionPool::acquireAsync(ConnectionWaiter* waiter)
+{
+    Connection* conn=nullptr;
+    if(_threadCacheIdle>0)
+    {
+        conn=takeCachedConnection();
+    }
+    if(conn==nullptr&&_waiterCnt.load()==0)
+    {
+        conn=takeIdleConnection(true);
+    }
+    if(conn!=nullptr)
+    {
+        waiter->conn=conn;
+        completeAsync(waiter);
+        return;
+    }
+
+    if(_breakerOpen.load())
+    {
+        waiter->rejected=true;
+        completeAsync(waiter);
+        return;
+    }
+    call_once(_asyncOnce,[this]()
+    {
+        thread async(&ConnectionPool::asyncAcquireTask,this);
+        async.detach();
+    });
+    {
+        //与同步的等待者排在同一个队列中，按到达顺序得到连接
+        lock_guard<mutex> lock(_waitMutex);
+        waiter->waited=true;
+        waiter->timer=_asyncTimers.emplace(waiter->deadline,waiter);
+        enqueueWaiter(waiter);
+        _produceCv.notify_one();
+        drainIdleToWaitersLocked();
+        //新的截止时间可能早于异步线程正在等待的时间
+        _asyncCv.notify_one();
+    }
+    //等待者已经入队，回调可能在其它线程上完成，之后不能再访问waiter
+    if(_threadCacheIdle>0)
+    {
+        spillForWaiters();
+    }
+}
+
+void ConnectionPool::completeAsync(ConnectionWaiter* waiter)
+{
+    function<void()> task=[this,waiter]()
+    {
+        Connection* conn=waiter->conn;
+        if(conn!=nullptr&&!validateConnection(conn))
+        {
+            //校验失败的连接已被关闭，截止时间不变，重新获取
+            waiter->conn=nullptr;
+            acquireAsync(waiter);
+            return;
+        }
+        if(waiter->waited)
+        {
+            _waitHist.record(chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now()-waiter->start).count());
+        }
+        if(conn==nullptr&&waiter->rejected)
+        {
+            _rejectCnt++;
+            LOG("熔断器打开，获取连接失败！");
+        }
+        else if(conn==nullptr)
+        {
+            _timeoutCnt++;
+            LOG("获取空闲时间超时，连接失败！");
+        }
+        AcquireCallback callback=move(waiter->callback);
+        delete waiter;
+        callback(conn!=nullptr?PooledConnection(this,conn):PooledConnection());
+    };
+    if(waiter->executor)
+    {
+        waiter->executor(move(task));
+    }
+    else
+    {
+        task();
+    }
+}
+
+void ConnectionPool::asyncAcquireTask()
+{
+    vector<ConnectionWaiter*> done;
+    while(1)
+    {
+        {
+            unique_lock<mutex> lock(_waitMutex);
+            while(_asyncDone.empty())
+            {
+                if(_asyncTimers.empty())
+                {
+                    _asyncCv.wait(lock);
+                    continue;
+                }
+                chrono::steady_clock::time_point now=chrono::steady_clock::now();
+                auto it=_asyncTimers.begin();
+                if(it->first>now)
+                {
+                    _asyncCv.wait_until(lock,it->first);
+                    continue;
+                }
+                //到达截止时间仍没有拿到连接，移出等待队列，以空连接完成
+                while(it!=_asyncTimers.end()&&it->first<=now)
+                {
+                    removeWaiter(it->second);
+                    _asyncDone.push_back(it->second);
+                    it=_asyncTimers.erase(it);
+                }
+            }
+            done.swap(_asyncDone);
+        }
+        //回调在锁外执行，回调中可以再借还连接
+        for(ConnectionWaiter* waiter:done)
+        {
+            completeAsync(waiter);
+        }
+        done.clear();
+    }
+}
+
+bool ConnectionPool::validateConnection(Connection* conn)
+{
+    if(_validationThreshold<=0||conn->getValidElapsed()<_validationThreshold)
+    {
+        return true;
+    }
+    if(conn->ping())
+    {
+        return true;
+    }
+    discardConnection(conn);
+    return false;
+}
+
+void ConnectionPool::discardConnection(Connection* conn)
+{
+    destroyConnection(conn);
+    _connectionCnt--;
+    _closedCnt++;
+    //连接数减少，生产者可能需要补充；持有_waitMutex通知，避免生产者检查条件后、等待前错过通知
+    lock_guard<mutex> lock(_waitMutex);
+    _produceCv.notify_one();
+}
+
+ConnectionPool::ThreadSlotTable::~ThreadSlotTable()
+{
+    for(auto& entry:slots)
+    {
+        entry.first->releaseThreadSlot(entry.second);
+    }
+}
+
+ThreadSlot* ConnectionPool::localSlot()
+{
+    //每个线程在每个连接池中有一个槽，线程通常只使用少数几个连接池，顺序查找即可
+    static thread_local ThreadSlotTable table;
+    for(auto& entry:table.slots)
+    {
+        if(entry.first==this)
+        {
+            return entry.second;
+        }
+    }
+    //ThreadSlot按缓存行对齐，用aligned_alloc分配，由releaseThreadSlot释放
+    ThreadSlot* slot=makeAlignedArray<ThreadSlot>(1).release();
+    {
+        lock_guard<mutex> lock(_slotMutex);
+        _threadSlots.push_back(slot);
+    }
+    table.slots.emplace_back(this,slot);
+    return slot;
+}
+
+Connection* ConnectionPool::takeCachedConnection()
+{
+    ThreadSlot* slot=localSlot();
+    Connection* conn=slot->conn.exchange(nullptr);
+    if(conn!=nullptr)
+    {
+        //只有本线程修改计数，不需要原子的读-改-写
+        slot->hits.store(slot->hits.load(memory_order_relaxed)+1,memory_order_relaxed);
+    }
+    return conn;
+}
+
+void ConnectionPool::releaseThreadSlot(ThreadSlot* slot)
+{
+    {
+        lock_guard<mutex> lock(_slotMutex);
+        _threadSlots.erase(find(_threadSlots.begin(),_threadSlots.end(),slot));
+        _releasedSlotHits+=slot->hits.load(memory_order_relaxed);
+    }
+    Connection* conn=slot->conn.exchange(nullptr);
+    if(conn!=nullptr)
+    {
+        releaseIdleConnection(conn);
+    }
+    AlignedArrayDeleter<ThreadSlot>(1)(slot);
+}
+
+void ConnectionPool::spillThreadCaches(bool all)
+{
+    vector<Connection*> spilled;
+    {
+        lock_guard<mutex> lock(_slotMutex);
+        for(ThreadSlot* slot:_threadSlots)
+        {
+            //先取出来再看空闲时间，取出后所属线程不会再同时使用它
+            Connection* conn=slot->conn.exchange(nullptr);
+            if(conn==nullptr)
+            {
+                continue;
+            }
+            if(all||_waiterCnt.load()>0||conn->getAliveTime()>=_threadCacheIdle)
+            {
+                spilled.push_back(conn);
+                continue;
+            }
+            //还没有空闲够，放回去；所属线程在此期间又放进了别的连接时，这一个还给连接池
+            Connection* empty=nullptr;
+            if(!slot->conn.compare_exchange_strong(empty,conn))
+            {
+                spilled.push_back(conn);
+            }
+        }
+    }
+    for(Connection* conn:spilled)
+    {
+        releaseIdleConnection(conn);
+    }
+}
+
+void ConnectionPool::spillForWaiters()
+{
+    //同一时刻只需要一个线程扫描所有缓存槽，交出的连接按到达顺序分给所有等待者；
+    //扫描过后才放进缓存槽的连接由归还者自己检查等待者后交出，漏掉的由扫描线程在下一个tick交出
+    if(_waiterCnt.load()==0||_spilling.exchange(true))
+    {
+        return;
+    }
+    spillThreadCaches(true);
+    _spilling.store(false);
+}
+
+void PooledConnection::reset()
+{
+    if(_conn!=nullptr)
+    {
+        _pool->putIdleConnection(_conn);
+        _pool=nullptr;
+        _conn=nullptr;
+    }
+}
+
+shared_ptr<Connection> PooledConnection::share()
+{
+    if(_conn==nullptr)
+    {
+        return nullptr;
+    }
+    ConnectionPool* pool=_pool;
+    Connection* conn=_conn;
+    _pool=nullptr;
+    _conn=nullptr;
+    return shared_ptr<Connection>(conn,[pool](Connection* cp)
+    {
+        pool->putIdleConnection(cp);
+    });
+}
+
+PoolStats ConnectionPool::stats()
+{
+    PoolStats st;
+    st.totalConnections=_connectionCnt;
+    st.idleConnections=_idleCnt;
+    st.activeConnections=max(0,st.totalConnections-st.idleConnections);
+    st.waiters=_waiterCnt;
+    st.targetSize=_targetSize;
+    st.maxSize=_maxSize;
+    st.timeouts=_timeoutCnt;
+    st.connectFailures=_connectFailCnt;
+    st.breakerRejects=_rejectCnt;
+    st.breakerOpen=_breakerOpen;
+    st.closedConnections=_closedCnt;
+    //快速路径的借用没有等待，计入0所在的桶
+    uint64_t fast=0;
+    for(int i=0;i<_shardNum;i++)
+    {
+        fast+=_shards[i].borrowCnt.load(memory_order_relaxed);
+    }
+    //从线程缓存借出的也是不需要等待的借用
+    {
+        lock_guard<mutex> lock(_slotMutex);
+        fast+=_releasedSlotHits;
+        for(ThreadSlot* slot:_threadSlots)
+        {
+            fast+=slot->hits.load(memory_order_relaxed);
+        }
+    }
+    st.acquireWaitUs=_waitHist.snapshot();
+    st.acquireWaitUs.counts[0]+=fast;
+    st.acquires=st.acquireWaitUs.total();
+    st.connectLatencyUs=_connectHist.snapshot();
+    return st;
+}
+
+void ConnectionPool::keepaliveConnectionTask()
+{
+    while(1)
+    {
+        this_thread::sleep_for(chrono::milliseconds(_keepaliveInterval));
+        for(int i=0;i<_shardNum;i++)
+        {
+            IdleShard& shard=_shards[i];
+            //把需要保活的连接先从分片中取出，ping期间它们不会被借出；
+            //队头是空闲最久的连接，最近使用过的热连接不需要ping
+            vector<Connection*> stale;
+            {
+                lock_guard<mutex> lock(shard.mtx);
+                auto last=remove_if(shard.que.begin(),shard.que.end(),[&](Connection* conn)
+                {
+                    if(conn->getValidElapsed()<_keepaliveInterval)
+                    {
+                        return false;
+                    }
+                    stale.push_back(conn);
+                    shard.wheel.remove(conn);
+                    return true;
+                });
+                shard.que.erase(last,shard.que.end());
+                _idleCnt-=stale.size();
+            }
+
+            //ping需要一次往返，在锁外进行
+            vector<Connection*> alive;
+            for(Connection* conn:stale)
+            {
+                if(conn->ping())
+                {
+                    alive.push_back(conn);
+                }
+                else
+                {
+                    discardConnection(conn);
+                }
+            }
+            if(alive.empty())
+            {
+                continue;
+            }
+
+            //仍然可用的连接放回原分片的队头，保持它们冷连接的位置，不打乱LIFO顺序
+            {
+                lock_guard<mutex> lock(shard.mtx);
+                shard.que.insert(shard.que.begin(),alive.begin(),alive.end());
+                for(Connection* conn:alive)
+                {
+                    shard.wheel.add(conn,idleExpireTick(conn));
+                }
+                _idleCnt+=alive.size();
+            }
+            if(_waiterCnt.load()>0)
+            {
+                lock_guard<mutex> lock(_waitMutex);
+                drainIdleToWaitersLocked();
+            }
+        }
+    }
+}
+
+void ConnectionPool::registerConnection(Connection* conn)
+{
+    lock_guard<mutex> lock(_rotationMutex);
+    _liveConns.insert(conn);
+    if(_maxLifetime<=0)
+    {
+        return;
+    }
+    //存活时间在[maxLifetime*(1-jitter),maxLifetime]之间均匀分布，同时建立的连接不会同时退役
+    static thread_local mt19937 rng(random_device{}());
+    long long lifetimeMs=_maxLifetime*1000LL;
+    long long jitterMs=lifetimeMs*max(0,min(100,_lifetimeJitter))/100;
+    if(jitterMs>0)
+    {
+        lifetimeMs-=uniform_int_distribution<long long>(0,jitterMs)(rng);
+    }
+    conn->setRetireTime(conn->getCreateTime()+chrono::milliseconds(lifetimeMs));
+    //退役前留出建立替代连接的时间，存活时间很短时取一半
+    long long leadMs=min(5000LL,lifetimeMs/2);
+    SpareRequest req;
+    req.due=conn->getRetireTime()-chrono::milliseconds(leadMs);
+    req.conn=conn;
+    req.createTime=conn->getCreateTime();
+    _spareDue.push(req);
+    req.due=conn->getRetireTime();
+    _retireDue.push(req);
+}
+
+void ConnectionPool::destroyConnection(Connection* conn)
+{
+    {
+        lock_guard<mutex> lock(_rotationMutex);
+        _liveConns.erase(conn);
+        //为它建立的替代连接改为直接顶替它的位置，没有建好的就不用再建了
+        if(_spareOwners.erase(conn)>0)
+        {
+            if(_spareCnt>0)
+            {
+                _spareCnt--;
+            }
+            else
+            {
+                lock_guard<mutex> waitLock(_waitMutex);
+                if(_spareRequest>0)
+                {
+                    _spareRequest--;
+                }
+            }
+        }
+    }
+    delete conn;
+}
+
+void ConnectionPool::requestSpareConnections()
+{
+    int num=0;
+    {
+        lock_guard<mutex> lock(_rotationMutex);
+        auto now=chrono::steady_clock::now();
+        while(!_spareDue.empty()&&_spareDue.top().due<=now)
+        {
+            SpareRequest req=_spareDue.top();
+            _spareDue.pop();
+            //连接可能已经被关闭，地址也可能被新连接复用，用建立时间再确认一次
+            if(_liveConns.count(req.conn)>0&&req.conn->getCreateTime()==req.createTime)
+            {
+                _spareOwners.insert(req.conn);
+                num++;
+            }
+        }
+    }
+    if(num>0)
+    {
+        lock_guard<mutex> lock(_waitMutex);
+        _spareRequest+=num;
+        _produceCv.notify_one();
+    }
+}
+
+bool ConnectionPool::claimRetirement(Connection* conn)
+{
+    lock_guard<mutex> lock(_rotationMutex);
+    //替代连接还没有建好时先继续使用，保证轮换期间连接池的容量不下降
+    if(_spareCnt==0||_spareOwners.erase(conn)==0)
+    {
+        return false;
+    }
+    _spareCnt--;
+    _liveConns.erase(conn);
+    return true;
+}
+
+bool ConnectionPool::retireConnection(Connection* conn)
+{
+    if(!claimRetirement(conn))
+    {
+        return false;
+    }
+    _connectionCnt--;
+    _closedCnt++;
+    delete conn;
+    return true;
+}
+
+void ConnectionPool::retireIdleConnections()
+{
+    vector<SpareRequest> due;
+    auto now=chrono::steady_clock::now();
+    {
+        lock_guard<mutex> lock(_rotationMutex);
+        while(!_retireDue.empty()&&_retireDue.top().due<=now)
+        {
+            SpareRequest req=_retireDue.top();
+            _retireDue.pop();
+            //已经关闭的连接不再处理；替代连接没有就绪时稍后再看
+            if(_liveConns.count(req.conn)==0||req.conn->getCreateTime()!=req.createTime)
+            {
+                continue;
+            }
+            if(_spareCnt>0&&_spareOwners.count(req.conn)>0)
+            {
+                due.push_back(req);
+            }
+            else
+            {
+                req.due=now+chrono::milliseconds(RETIRE_RETRY_MS);
+                _retireDue.push(req);
+            }
+        }
+    }
+    vector<SpareRequest> later;
+    for(SpareRequest& req:due)
+    {
+        //先在分片锁内把空闲的连接取出来，再单独获取_rotationMutex，两把锁不嵌套
+        Connection* conn=nullptr;
+        for(int i=0;i<_shardNum&&conn==nullptr;i++)
+        {
+            IdleShard& shard=_shards[i];
+            lock_guard<mutex> lock(shard.mtx);
+            auto it=find(shard.que.begin(),shard.que.end(),req.conn);
+            //地址可能已经被新连接复用，在分片中说明连接还活着，可以比较建立时间
+            if(it!=shard.que.end()&&req.conn->getCreateTime()==req.createTime)
+            {
+                conn=*it;
+                shard.que.erase(it);
+                shard.wheel.remove(conn);
+                _idleCnt--;
+            }
+        }
+        if(conn==nullptr)
+        {
+            //正被借出，归还时会检查退役时间；还在线程缓存中的稍后再看
+            req.due=now+chrono::milliseconds(RETIRE_RETRY_MS);
+            later.push_back(req);
+            continue;
+        }
+        if(!claimRetirement(conn))
+        {
+            //替代连接刚被别的连接用掉了，放回连接池继续使用
+            releaseIdleConnection(conn);
+            req.due=now+chrono::milliseconds(RETIRE_RETRY_MS);
+            later.push_back(req);
+            continue;
+        }
+        _connectionCnt--;
+        _closedCnt++;
+        delete conn;
+    }
+    if(!later.empty())
+    {
+        lock_guard<mutex> lock(_rotationMutex);
+        for(SpareRequest& req:later)
+        {
+            _retireDue.push(req);
+        }
+    }
+}
+
+uint64_t ConnectionPool::tickOf(chrono::steady_clock::time_point time) const
+{
+    return chrono::duration_cast<chrono::milliseconds>(time-_wheelEpoch).count()/REAP_TICK_MS;
+}
+
+uint64_t ConnectionPool::idleExpireTick(Connection* conn) const
+{
+    //向上取整，连接不会早于maxIdleTime被回收，最多晚一个tick
+    return tickOf(conn->getIdleSince())+(_maxIdleTime*1000+REAP_TICK_MS-1)/REAP_TICK_MS+1;
+}
+
+void ConnectionPool::scannerConnectionTask()
+{
+    uint64_t tick=tickOf(chrono::steady_clock::now());
+    while(1)
+    {
+        //每个tick醒来一次，只处理刚好到期的连接，不再每隔maxIdleTime整体扫描一遍
+        tick++;
+        this_thread::sleep_until(_wheelEpoch+chrono::milliseconds(tick*REAP_TICK_MS));
+        reapIdleConnections(tick);
+        requestSpareConnections();
+        if(_maxLifetime>0)
+        {
+            retireIdleConnections();
+        }
+        if(_threadCacheIdle>0)
+        {
+            spillThreadCaches(false);
+        }
+    }
+}
+
+void ConnectionPool::reapIdleConnections(uint64_t tick)
+{
+    //控制线程认为需要的连接不回收
+    int keepNum=max(_initSize,_targetSize.load());
+    vector<Connection*> closing;
+    vector<Connection*> expired;
+    for(int i=0;i<_shardNum;i++)
+    {
+        IdleShard& shard=_shards[i];
+        lock_guard<mutex> lock(shard.mtx);
+        expired.clear();
+        shard.wheel.advance(tick,expired);
+        for(Connection* conn:expired)
+        {
+            if(_connectionCnt<=keepNum)
+            {
+                //连接数已经降到下限，保留的连接重新开始计时
+                shard.wheel.add(conn,tick+(_maxIdleTime*1000+REAP_TICK_MS-1)/REAP_TICK_MS);
+                continue;
+            }
+            shard.que.erase(find(shard.que.begin(),shard.que.end(),conn));
+            _idleCnt--;
+            _connectionCnt--;
+            _closedCnt++;
+            closing.push_back(conn);
+        }
+    }
+    //关闭连接需要和服务器通信，放在锁外进行
+    for(Connection* conn:closing)
+    {
+        destroyConnection(conn);
+    }
+}
+
+void ConnectionPool::closeIdleConnections(int keepNum)
+{
+    while(_connectionCnt>keepNum)
+    {
+        //找出各分片队头中空闲最久的连接
+        int oldest=-1;
+        long long oldestIdle=-1;
+        for(int i=0;i<_shardNum;i++)
+        {
+            lock_guard<mutex> lock(_shards[i].mtx);
+            if(!_shards[i].que.empty()&&_shards[i].que.front()->getAliveTime()>oldestIdle)
+            {
+                oldest=i;
+                oldestIdle=_shards[i].que.front()->getAliveTime();
+            }
+        }
+        if(oldest<0)
+        {
+            break;
+        }
+
+        Connection* p=nullptr;
+        {
+            IdleShard& shard=_shards[oldest];
+            lock_guard<mutex> lock(shard.mtx);
+            //加锁期间队头可能已被借走，此时重新查找
+            if(!shard.que.empty())
+            {
+                p=shard.que.front();
+                shard.que.erase(shard.que.begin());
+                shard.wheel.remove(p);
+                _idleCnt--;
+                _connectionCnt--;
+                _closedCnt++;
+            }
+        }
+        //关闭连接需要和服务器通信，放在锁外进行
+        if(p!=nullptr)
+        {
+            destroyConnection(p);
+        }
+    }
+}
+
+void ConnectionPool::sizingControllerTask()
+{
+    //每个周期内采样若干次，得到借用速率的峰值和借出连接数的平均值
+    const int samplesPerTick=10;
+    auto sampleInterval=chrono::milliseconds(max(1,_sizingInterval/samplesPerTick));
+
+    HistogramSnapshot lastWait=stats().acquireWaitUs;
+    int shrinkTicks=0;
+    while(1)
+    {
+        double peakRate=0;
+        double busySum=0;
+        auto tickStart=chrono::steady_clock::now();
+        auto sampleStart=tickStart;
+        uint64_t sampleBorrows=lastWait.total();
+        for(int i=0;i<samplesPerTick;i++)
+        {
+            this_thread::sleep_for(sampleInterval);
+            auto now=chrono::steady_clock::now();
+            PoolStats st=stats();
+            double seconds=chrono::duration<double>(now-sampleStart).count();
+            if(seconds>0)
+            {
+                peakRate=max(peakRate,(st.acquires-sampleBorrows)/seconds);
+            }
+            busySum+=st.activeConnections;
+            sampleStart=now;
+            sampleBorrows=st.acquires;
+        }
+        double tickSeconds=chrono::duration<double>(chrono::steady_clock::now()-tickStart).count();
+
+        //本周期的等待时间分布
+        HistogramSnapshot curWait=stats().acquireWaitUs;
+        HistogramSnapshot window=curWait-lastWait;
+        uint64_t borrows=window.total();
+        lastWait=curWait;
+        if(!_warmupDone)
+        {
+            continue;
+        }
+
+        //Little定律：平均借出连接数L=借用速率λ×平均持有时间W，由采样的L和λ反推W，
+        //再按周期内的峰值速率估算需要的连接数，使突发流量到来时连接已经就绪
+        double busy=busySum/samplesPerTick;
+        double rate=tickSeconds>0?borrows/tickSeconds:0;
+        double holdSeconds=rate>0?busy/rate:0;
+        int target=(int)ceil(peakRate*holdSeconds*(100+_sizingHeadroom)/100);
+        int current=_connectionCnt;
+
+        //等待时间的p99超过阈值说明连接已经不够用，借出连接数被连接总数截断，
+        //此时Little定律低估了需求，按等待者数量和当前规模的一半中较大者扩容
+        uint64_t p99=window.percentile(99);
+        if(p99>(uint64_t)_growWaitThreshold*1000)
+        {
+            target=max(target,current+max(_waiterCnt.load(),max(1,current/2)));
+        }
+        target=max(_initSize,min(_maxSize,target));
+
+        if(target>_targetSize)
+        {
+            //扩容立即生效
+            shrinkTicks=0;
+            lock_guard<mutex> lock(_waitMutex);
+            _targetSize=target;
+            _produceCv.notify_one();
+        }
+        else if(target<_targetSize*(100-_shrinkHysteresis)/100.0)
+        {
+            //缩容需要连续_shrinkDelay个周期都远低于目标连接数，避免在临界点来回抖动
+            if(++shrinkTicks>=_shrinkDelay)
+            {
+                shrinkTicks=0;
+                _targetSize=target;
+                closeIdleConnections(target);
+            }
+        }
+        else
+        {
+            shrinkTicks=0;
+        }
+    }
+}
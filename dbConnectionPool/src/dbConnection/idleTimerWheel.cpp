@@ -0,0 +1,72 @@
+#include"idleTimerWheel.hpp"
+#include"connection.hpp"
+
+IdleTimerWheel::IdleTimerWheel(int slotNum)
+    :_slots(slotNum,nullptr),_currentTick(0)
+{
+}
+
+void IdleTimerWheel::add(Connection* conn,uint64_t expireTick)
+{
+    conn->_expireTick=expireTick;
+    //已经过期的条目放进下一个要处理的槽
+    conn->_wheelSlot=max(expireTick,_currentTick+1)%_slots.size();
+    Connection*& head=_slots[conn->_wheelSlot];
+    conn->_wheelPrev=nullptr;
+    conn->_wheelNext=head;
+    if(head!=nullptr)
+    {
+        head->_wheelPrev=conn;
+    }
+    head=conn;
+}
+
+void IdleTimerWheel::remove(Connection* conn)
+{
+    if(conn->_wheelSlot<0)
+    {
+        return;
+    }
+    if(conn->_wheelPrev!=nullptr)
+    {
+        conn->_wheelPrev->_wheelNext=conn->_wheelNext;
+    }
+    else
+    {
+        _slots[conn->_wheelSlot]=conn->_wheelNext;
+    }
+    if(conn->_wheelNext!=nullptr)
+    {
+        conn->_wheelNext->_wheelPrev=conn->_wheelPrev;
+    }
+    conn->_wheelPrev=conn->_wheelNext=nullptr;
+    conn->_wheelSlot=-1;
+}
+
+void IdleTimerWheel::advance(uint64_t tick,vector<Connection*>& expired)
+{
+    //落后超过一圈时每个槽只需要处理一次
+    uint64_t from=_currentTick+1;
+    if(tick>=_slots.size()&&from<tick-_slots.size()+1)
+    {
+        from=tick-_slots.size()+1;
+    }
+    for(uint64_t t=from;t<=tick;t++)
+    {
+        Connection* conn=_slots[t%_slots.size()];
+        while(conn!=nullptr)
+        {
+            Connection* next=conn->_wheelNext;
+            if(conn->_expireTick<=tick)
+            {
+                remove(conn);
+                expired.push_back(conn);
+            }
+            conn=next;
+        }
+    }
+    if(tick>_currentTick)
+    {
+        _currentTick=tick;
+    }
+}
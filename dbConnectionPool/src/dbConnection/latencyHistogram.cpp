@@ -0,0 +1,100 @@
+#include"latencyHistogram.hpp"
+
+uint64_t HistogramSnapshot::total() const
+{
+    uint64_t sum=0;
+    for(uint64_t cnt:counts)
+    {
+        sum+=cnt;
+    }
+    return sum;
+}
+
+uint64_t HistogramSnapshot::percentile(double p) const
+{
+    uint64_t all=total();
+    if(all==0)
+    {
+        return 0;
+    }
+    //第rank个样本所在的桶，rank从1开始
+    uint64_t rank=(uint64_t)(p/100*all);
+    if(rank<1)
+    {
+        rank=1;
+    }
+    uint64_t seen=0;
+    for(size_t i=0;i<counts.size();i++)
+    {
+        seen+=counts[i];
+        if(seen>=rank)
+        {
+            return LatencyHistogram::bucketUpper(i);
+        }
+    }
+    return LatencyHistogram::bucketUpper(counts.size()-1);
+}
+
+double HistogramSnapshot::mean() const
+{
+    uint64_t all=total();
+    return all==0?0:(double)sum/all;
+}
+
+HistogramSnapshot HistogramSnapshot::operator-(const HistogramSnapshot& other) const
+{
+    HistogramSnapshot diff;
+    diff.counts.resize(counts.size());
+    for(size_t i=0;i<counts.size();i++)
+    {
+        uint64_t before=i<other.counts.size()?other.counts[i]:0;
+        diff.counts[i]=counts[i]>before?counts[i]-before:0;
+    }
+    diff.sum=sum>other.sum?sum-other.sum:0;
+    return diff;
+}
+
+LatencyHistogram::LatencyHistogram()
+{
+    for(int i=0;i<BUCKET_NUM;i++)
+    {
+        _counts[i].store(0,memory_order_relaxed);
+    }
+    _sum.store(0,memory_order_relaxed);
+}
+
+HistogramSnapshot LatencyHistogram::snapshot() const
+{
+    HistogramSnapshot snap;
+    snap.counts.resize(BUCKET_NUM);
+    for(int i=0;i<BUCKET_NUM;i++)
+    {
+        snap.counts[i]=_counts[i].load(memory_order_relaxed);
+    }
+    snap.sum=_sum.load(memory_order_relaxed);
+    return snap;
+}
+
+int LatencyHistogram::bucketOf(uint64_t value)
+{
+    if(value<(uint64_t)SUB_BUCKET_NUM)
+    {
+        return value;
+    }
+    //最高位所在的位置决定区间，其后的SUB_BUCKET_BITS位决定子桶
+    int exponent=63-__builtin_clzll(value);
+    int sub=(value>>(exponent-SUB_BUCKET_BITS))&(SUB_BUCKET_NUM-1);
+    return (exponent-SUB_BUCKET_BITS+1)*SUB_BUCKET_NUM+sub;
+}
+
+uint64_t LatencyHistogram::bucketUpper(int bucket)
+{
+    if(bucket<SUB_BUCKET_NUM)
+    {
+        return bucket;
+    }
+    int exponent=bucket/SUB_BUCKET_NUM+SUB_BUCKET_BITS-1;
+    uint64_t sub=bucket%SUB_BUCKET_NUM;
+    uint64_t lower=(1ULL<<exponent)|(sub<<(exponent-SUB_BUCKET_BITS));
+    return lower+(1ULL<<(exponent-SUB_BUCKET_BITS))-1;
+}
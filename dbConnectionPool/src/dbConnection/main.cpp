@@ -1,7 +1,18 @@
 #include<iostream>
 #include<list>
+#include<vector>
+#include<chrono>
+#include<atomic>
+#include<climits>
 #include"connection.hpp"
 #include"connectionPool.hpp"
+#include"asyncQueryEngine.hpp"
+#include"batchInsert.hpp"
+#include"readWriteRouter.hpp"
+#include"awaitable.hpp"
+#include"transaction.hpp"
+#include"writeBehindQueue.hpp"
+#include"bulkLoader.hpp"
 using namespace std;
 
 const int dataNum=1000;//测试数据量
@@ -25,7 +36,7 @@ void connPoolTest()
     ConnectionPool* cp=ConnectionPool::getConnectionPool();
     for(int i=0;i<dataNum;i++)
     {
-        shared_ptr<Connection> sp=cp->getConnection();
+        PooledConnection sp=cp->getConnection();
         char sql[1024]={0};
         sprintf(sql,
         "insert into user(name,age,sex) values('%s',%d,'%s')",
@@ -34,6 +45,147 @@ void connPoolTest()
     }
 }
 
+//使用预处理语句的连接池测试，语句在每个连接上只预处理一次，之后从缓存中取出直接绑定参数执行
+void connPoolStmtTest()
+{
+    ConnectionPool* cp=ConnectionPool::getConnectionPool();
+    for(int i=0;i<dataNum;i++)
+    {
+        PooledConnection sp=cp->getConnection();
+        PreparedStatement* stmt=sp->prepare("insert into user(name,age,sex) values(?,?,?)");
+        if(stmt==nullptr)
+        {
+            continue;
+        }
+        stmt->setString(0,"zhangsan");
+        stmt->setInt(1,20);
+        stmt->setString(2,"male");
+        stmt->execute();
+    }
+}
+
+//预处理查询测试，热点查询语句只在连接上预处理一次，按参数执行后逐行读取结果
+void connPoolStmtQueryTest()
+{
+    ConnectionPool* cp=ConnectionPool::getConnectionPool();
+    PooledConnection sp=cp->getConnection();
+    if(sp==nullptr)
+    {
+        return;
+    }
+    PreparedStatement* stmt=sp->prepare("select name,age,sex from user where age>=? limit 10");
+    if(stmt==nullptr)
+    {
+        return;
+    }
+    stmt->setInt(0,18);
+    if(!stmt->execute())
+    {
+        return;
+    }
+    while(stmt->fetch())
+    {
+        for(unsigned int i=0;i<stmt->fieldCount();i++)
+        {
+            std::cout << (stmt->isNull(i)?string_view("NULL"):stmt->column(i)) << " ";
+        }
+        std::cout << std::endl;
+    }
+}
+
+//多行批量插入测试，dataNum行数据按max_allowed_packet拼成尽量少的INSERT语句
+void connPoolBatchTest()
+{
+    ConnectionPool* cp=ConnectionPool::getConnectionPool();
+    PooledConnection sp=cp->getConnection();
+    if(sp==nullptr)
+    {
+        return;
+    }
+    BatchInsert batch=sp->insertBatch("insert into user(name,age,sex)");
+    for(int i=0;i<dataNum;i++)
+    {
+        batch.addRow({"zhangsan",to_string(20),"male"});
+    }
+    batch.flush();
+    for(const BatchError& err:batch.errors())
+    {
+        std::cout << "rows [" << err.firstRow << "," << err.firstRow+err.rowCount
+                  << ") failed: " << err.error << std::endl;
+    }
+}
+
+//多语句流水线测试：一次往返执行多条独立语句，并逐条取回结果
+void connPoolPipelineTest()
+{
+    ConnectionPool* cp=ConnectionPool::getConnectionPool();
+    PooledConnection sp=cp->getConnection();
+    if(sp==nullptr)
+    {
+        return;
+    }
+    vector<string> stmts={
+        "insert into user(name,age,sex) values('zhangsan',20,'male')",
+        "update user set age=21 where name='zhangsan'",
+        "select count(*) from user",
+        "delete from user where name='zhangsan'"
+    };
+    vector<PipelineResult> results;
+    sp->pipeline(stmts,results);
+    for(size_t i=0;i<results.size();i++)
+    {
+        std::cout << i << ": " << (results[i].executed?(results[i].ok?"ok":results[i].error):"not executed")
+                  << "  affected: " << results[i].affectedRows
+                  << "  rows: " << results[i].rows.size() << std::endl;
+    }
+}
+
+//流式结果集测试：列以string_view的形式直接指向客户端库的缓冲区，
+//没有读完的结果集会在连接归还时自动读完并释放
+void connPoolQueryTest()
+{
+    ConnectionPool* cp=ConnectionPool::getConnectionPool();
+    PooledConnection sp=cp->getConnection();
+    if(sp==nullptr)
+    {
+        return;
+    }
+    ResultSet rs=sp->query("select name,age,sex from user limit 10");
+    for(const Row& row:rs)
+    {
+        for(size_t i=0;i<row.size();i++)
+        {
+            std::cout << (row.isNull(i)?string_view("NULL"):row[i]) << " ";
+        }
+        std::cout << std::endl;
+    }
+}
+
+//查询结果缓存测试（需要在mysql.cnf中配置queryCacheSize）：重复的SELECT命中缓存，写入user表后相关结果失效
+void connPoolQueryCacheTest()
+{
+    ConnectionPool* cp=ConnectionPool::getConnectionPool();
+    for(int i=0;i<dataNum;i++)
+    {
+        PooledConnection sp=cp->getConnection();
+        if(sp==nullptr)
+        {
+            continue;
+        }
+        sp->cachedQuery("select count(*) from user");
+        if(i%100==0)
+        {
+            sp->update("insert into user(name,age,sex) values('zhangsan',20,'male')");
+        }
+    }
+    if(cp->getQueryCache()!=nullptr)
+    {
+        QueryCacheStats st=cp->getQueryCache()->stats();
+        std::cout << "hits: " << st.hits << "  misses: " << st.misses
+                  << "  invalidations: " << st.invalidations << std::endl;
+    }
+}
+
 //单线程服务器压力测试（不使用连接池）
 void singleThreadConnTest()
 {
@@ -54,6 +206,26 @@ void singleThreadConnPoolTest()
     std::cout << "Time taken: " << duration << " seconds" << std::endl;
 }
 
+//单线程连接池预处理语句压力测试
+void singleThreadConnPoolStmtTest()
+{
+    clock_t begin=clock();
+    connPoolStmtTest();
+    clock_t end=clock();
+    double duration = (double)(end - begin) / CLOCKS_PER_SEC;
+    std::cout << "Time taken: " << duration << " seconds" << std::endl;
+}
+
+//单线程连接池批量插入压力测试
+void singleThreadConnPoolBatchTest()
+{
+    clock_t begin=clock();
+    connPoolBatchTest();
+    clock_t end=clock();
+    double duration = (double)(end - begin) / CLOCKS_PER_SEC;
+    std::cout << "Time taken: " << duration << " seconds" << std::endl;
+}
+
 //多线程连接测试（不使用连接池）
 void mutiThreadConnection()
 {
@@ -96,6 +268,371 @@ void mutiThreadConnectionPool()
     std::cout << "Time taken: " << duration << " seconds" << std::endl;
 }
 
+//借还连接吞吐量测试：不执行SQL，只测量getConnection和归还的开销随线程数的变化
+void poolScalingBenchmark()
+{
+    const int opsPerThread=100000;
+    ConnectionPool* cp=ConnectionPool::getConnectionPool();
+    //初始连接在后台并发建立，测量前先等待全部就绪
+    cp->waitReady(INT_MAX,5000);
+    unsigned int maxThreads=max(1u,thread::hardware_concurrency())*2;
+    for(unsigned int threadNum=1;threadNum<=maxThreads;threadNum*=2)
+    {
+        atomic_int failed(0);
+        auto begin=chrono::steady_clock::now();
+        vector<thread> tl;
+        for(unsigned int i=0;i<threadNum;i++)
+        {
+            tl.emplace_back([&]()
+            {
+                for(int j=0;j<opsPerThread;j++)
+                {
+                    PooledConnection sp=cp->getConnection();
+                    if(sp==nullptr)
+                    {
+                        failed++;
+                    }
+                }
+            });
+        }
+        for(auto& tt:tl)
+        {
+            tt.join();
+        }
+        double duration=chrono::duration<double>(chrono::steady_clock::now()-begin).count();
+        std::cout << "threads: " << threadNum
+                  << "  ops/s: " << (threadNum*opsPerThread)/duration
+                  << "  failed: " << failed << std::endl;
+    }
+}
+
+//连接池统计：多线程借还后输出JSON快照，并写出供node_exporter采集的Prometheus文本文件
+void poolStatsTest()
+{
+    ConnectionPool* cp=ConnectionPool::getConnectionPool();
+    cp->waitReady(1,5000);
+    vector<thread> tl;
+    for(int i=0;i<8;i++)
+    {
+        tl.emplace_back([&]()
+        {
+            for(int j=0;j<dataNum;j++)
+            {
+                PooledConnection sp=cp->getConnection();
+            }
+        });
+    }
+    for(auto& tt:tl)
+    {
+        tt.join();
+    }
+    PoolStats st=cp->stats();
+    std::cout << st.toJson() << std::endl;
+    PoolStats::writeFile("dbpool.prom",st.toPrometheus(cp->getName()));
+}
+
+//读写分离测试：需要在mysql.cnf中配置replicas，四个线程交替读写，输出各从库分到的读请求数
+void readWriteSplitTest()
+{
+    ReadWriteRouter* router=ReadWriteRouter::getRouter();
+    const vector<ConnectionPool*>& replicas=router->getReplicas();
+    vector<atomic_int> reads(replicas.size()+1);
+    vector<thread> tl;
+    for(int i=0;i<4;i++)
+    {
+        tl.emplace_back([&]()
+        {
+            for(int j=0;j<dataNum;j++)
+            {
+                string sql=j%4==0?"insert into user(name,age,sex) values('zhangsan',20,'male')"
+                                :"select count(*) from user";
+                PooledConnection sp=router->getConnection(sql);
+                if(sp==nullptr)
+                {
+                    continue;
+                }
+                if(ReadWriteRouter::isReadOnly(sql))
+                {
+                    sp->query(sql);
+                    //最后一个计数是退回主库的读请求
+                    size_t idx=0;
+                    while(idx<replicas.size()&&replicas[idx]!=sp.getPool())
+                    {
+                        idx++;
+                    }
+                    reads[idx]++;
+                }
+                else
+                {
+                    sp->update(sql);
+                }
+            }
+        });
+    }
+    for(auto& tt:tl)
+    {
+        tt.join();
+    }
+    for(size_t k=0;k<replicas.size();k++)
+    {
+        std::cout << "replica " << router->getPrimary()->getReplicas()[k] << " reads: " << reads[k] << std::endl;
+    }
+    std::cout << "primary reads: " << reads[replicas.size()] << std::endl;
+}
+
+//异步查询引擎测试：两个事件循环线程同时驱动dataNum条插入
+void asyncQueryTest()
+{
+    ConnectionPool* cp=ConnectionPool::getConnectionPool();
+    AsyncQueryEngine engine(cp,2);
+    auto begin=chrono::steady_clock::now();
+    atomic_int okCnt(0);
+    atomic_int doneCnt(0);
+    for(int i=0;i<dataNum;i++)
+    {
+        char sql[1024]={0};
+        sprintf(sql,
+        "insert into user(name,age,sex) values('%s',%d,'%s')",
+        "zhangsan",20,"male");
+        engine.execute(sql,[&](AsyncQueryResult& result)
+        {
+            if(result.ok)
+            {
+                okCnt++;
+            }
+            doneCnt++;
+        });
+    }
+    //futures形式
+    future<AsyncQueryResult> fut=engine.execute("select count(*) from user");
+    AsyncQueryResult result=fut.get();
+    while(doneCnt<dataNum)
+    {
+        this_thread::yield();
+    }
+    double duration=chrono::duration<double>(chrono::steady_clock::now()-begin).count();
+    std::cout << "Time taken: " << duration << " seconds, ok: " << okCnt
+              << ", rows: " << (result.ok&&!result.rows.empty()?result.rows[0][0]:string("-")) << std::endl;
+}
+
+//异步获取连接测试：拿到连接后交给异步查询引擎执行插入，发起线程既不等待连接也不等待查询
+void asyncAcquireTest()
+{
+    ConnectionPool* cp=ConnectionPool::getConnectionPool();
+    AsyncQueryEngine engine(cp,2);
+    auto begin=chrono::steady_clock::now();
+    atomic_int okCnt(0);
+    atomic_int doneCnt(0);
+    for(int i=0;i<dataNum;i++)
+    {
+        //连接被取空时请求在等待队列中排队，回调在连接池的异步线程中执行，只提交查询，不阻塞
+        cp->getConnectionAsync([&](PooledConnection conn)
+        {
+            if(conn==nullptr)
+            {
+                doneCnt++;
+                return;
+            }
+            engine.execute(move(conn),"insert into user(name,age,sex) values('zhangsan',20,'male')",
+                [&](AsyncQueryResult& result)
+            {
+                if(result.ok)
+                {
+                    okCnt++;
+                }
+                doneCnt++;
+            });
+        });
+    }
+    //future形式
+    future<PooledConnection> fut=cp->getConnectionAsync();
+    std::cout << "future acquired: " << (fut.get()!=nullptr) << std::endl;
+    while(doneCnt<dataNum)
+    {
+        this_thread::yield();
+    }
+    double duration=chrono::duration<double>(chrono::steady_clock::now()-begin).count();
+    std::cout << "Time taken: " << duration << " seconds, ok: " << okCnt << std::endl;
+}
+
+//一个协程：异步获取连接后在同一个连接上执行一条插入，全程不阻塞线程
+AsyncTask insertCoroutine(ConnectionPool* cp,AsyncQueryEngine* engine,atomic_int& okCnt,atomic_int& doneCnt)
+{
+    PooledConnection conn=co_await asyncAcquire(cp);
+    AsyncQueryResult result=co_await asyncQuery(engine,conn,"insert into user(name,age,sex) values('zhangsan',20,'male')");
+    if(result.ok)
+    {
+        okCnt++;
+    }
+    doneCnt++;
+}
+
+//协程与阻塞方式的对比：同样执行dataNum条插入，
+//阻塞方式每个在途请求占用一个线程，协程方式只用一个发起线程和两个事件循环线程
+void coroutineBenchmark()
+{
+    ConnectionPool* cp=ConnectionPool::getConnectionPool();
+    cp->waitReady(INT_MAX,10000);
+    const int threadNum=16;
+
+    auto begin=chrono::steady_clock::now();
+    vector<thread> tl;
+    for(int i=0;i<threadNum;i++)
+    {
+        tl.emplace_back([cp]()
+        {
+            for(int j=0;j<dataNum/threadNum;j++)
+            {
+                PooledConnection sp=cp->getConnection();
+                if(sp!=nullptr)
+                {
+                    sp->update("insert into user(name,age,sex) values('zhangsan',20,'male')");
+                }
+            }
+        });
+    }
+    for(auto& tt:tl)
+    {
+        tt.join();
+    }
+    double blocking=chrono::duration<double>(chrono::steady_clock::now()-begin).count();
+
+    AsyncQueryEngine engine(cp,2);
+    atomic_int okCnt(0);
+    atomic_int doneCnt(0);
+    begin=chrono::steady_clock::now();
+    for(int i=0;i<dataNum/threadNum*threadNum;i++)
+    {
+        insertCoroutine(cp,&engine,okCnt,doneCnt);
+    }
+    while(doneCnt<dataNum/threadNum*threadNum)
+    {
+        this_thread::yield();
+    }
+    double coroutine=chrono::duration<double>(chrono::steady_clock::now()-begin).count();
+    std::cout << "blocking(" << threadNum << " threads): " << blocking << " seconds, "
+              << "coroutine: " << coroutine << " seconds, ok: " << okCnt << std::endl;
+}
+
+//组提交测试：16个线程各提交dataNum/16个两条语句的小事务，对比每个事务单独提交和组提交的耗时
+void groupCommitTest()
+{
+    ConnectionPool* cp=ConnectionPool::getConnectionPool();
+    const int threadNum=16;
+    const string insertSql="insert into user(name,age,sex) values('zhangsan',20,'male')";
+    const string updateSql="update user set age=age+1 where name='zhangsan' limit 1";
+
+    auto begin=chrono::steady_clock::now();
+    vector<thread> tl;
+    for(int i=0;i<threadNum;i++)
+    {
+        tl.emplace_back([&]()
+        {
+            for(int j=0;j<dataNum/threadNum;j++)
+            {
+                PooledConnection sp=cp->getConnection();
+                if(sp==nullptr)
+                {
+                    continue;
+                }
+                //离开作用域时没有提交的事务自动回滚
+                Transaction txn(sp.get());
+                if(txn.update(insertSql)&&txn.update(updateSql))
+                {
+                    txn.commit();
+                }
+            }
+        });
+    }
+    for(auto& tt:tl)
+    {
+        tt.join();
+    }
+    double single=chrono::duration<double>(chrono::steady_clock::now()-begin).count();
+
+    atomic_int okCnt(0);
+    begin=chrono::steady_clock::now();
+    {
+        GroupCommitter committer(cp,5,128);
+        tl.clear();
+        for(int i=0;i<threadNum;i++)
+        {
+            tl.emplace_back([&]()
+            {
+                for(int j=0;j<dataNum/threadNum;j++)
+                {
+                    if(committer.execute({insertSql,updateSql}))
+                    {
+                        okCnt++;
+                    }
+                }
+            });
+        }
+        for(auto& tt:tl)
+        {
+            tt.join();
+        }
+    }
+    double group=chrono::duration<double>(chrono::steady_clock::now()-begin).count();
+    std::cout << "single transactions: " << single << " seconds, group commit: " << group
+              << " seconds, ok: " << okCnt << std::endl;
+}
+
+//写回队列测试：4个线程只把行放进队列，后台刷新线程批量写入，分别统计入队和全部写入的耗时
+void writeBehindTest()
+{
+    ConnectionPool* cp=ConnectionPool::getConnectionPool();
+    WriteBehindQueue queue(cp,"insert into user(name,age,sex)",65536,1000,100,OverflowPolicy::BLOCK);
+    auto begin=chrono::steady_clock::now();
+    vector<thread> tl;
+    for(int i=0;i<4;i++)
+    {
+        tl.emplace_back([&]()
+        {
+            for(int j=0;j<dataNum/4;j++)
+            {
+                queue.enqueue({"zhangsan","20","male"});
+            }
+        });
+    }
+    for(auto& tt:tl)
+    {
+        tt.join();
+    }
+    double enqueue=chrono::duration<double>(chrono::steady_clock::now()-begin).count();
+    queue.flush();
+    double total=chrono::duration<double>(chrono::steady_clock::now()-begin).count();
+    WriteBehindStats st=queue.stats();
+    std::cout << "enqueue: " << enqueue << " seconds, written: " << total << " seconds, rows: "
+              << st.written << ", failed: " << st.failed << ", dropped: " << st.dropped << std::endl;
+}
+
+//批量导入测试：需要在mysql.cnf中打开localInfile，服务器设置local_infile=ON
+//生产者每次生成100行，导入dataNum*100行
+void bulkLoadTest()
+{
+    ConnectionPool* cp=ConnectionPool::getConnectionPool();
+    PooledConnection sp=cp->getConnection();
+    if(sp==nullptr)
+    {
+        return;
+    }
+    BulkLoader loader(sp.get(),"user",{"name","age","sex"});
+    int produced=0;
+    auto begin=chrono::steady_clock::now();
+    bool ok=loader.load([&](BulkChunk& chunk)
+    {
+        for(int i=0;i<100;i++)
+        {
+            chunk.addRow({"zhangsan","20","male"});
+        }
+        return ++produced<dataNum;
+    });
+    double duration=chrono::duration<double>(chrono::steady_clock::now()-begin).count();
+    std::cout << "Time taken: " << duration << " seconds, ok: " << ok
+              << ", rows: " << loader.affectedRows() << std::endl;
+}
+
 int main()
 {
     /*
@@ -111,6 +648,24 @@ int main()
     dataNum:10000    ->  time:3.37099 s
     */
     singleThreadConnPoolTest();
+
+    //单线程连接池+预处理语句缓存
+    // singleThreadConnPoolStmtTest();
+
+    //预处理查询语句读取结果
+    // connPoolStmtQueryTest();
+
+    //单线程连接池+多行批量插入
+    // singleThreadConnPoolBatchTest();
+
+    //多语句流水线
+    // connPoolPipelineTest();
+
+    //流式结果集
+    // connPoolQueryTest();
+
+    //查询结果缓存
+    // connPoolQueryCacheTest();
     
     /*
     dataNum:1000    ->  time:2.48859 s
@@ -125,6 +680,33 @@ int main()
     dataNum:10000    ->  time:1.72819 s
     */
     // mutiThreadConnectionPool();
+
+    //借还连接吞吐量随线程数的扩展性
+    // poolScalingBenchmark();
+
+    //连接池统计导出
+    // poolStatsTest();
+
+    //读写分离
+    // readWriteSplitTest();
+
+    //异步查询引擎
+    // asyncQueryTest();
+
+    //异步获取连接
+    // asyncAcquireTest();
+
+    //协程与阻塞方式对比
+    // coroutineBenchmark();
+
+    //事务与组提交
+    // groupCommitTest();
+
+    //写回队列
+    // writeBehindTest();
+
+    //LOAD DATA LOCAL INFILE批量导入
+    // bulkLoadTest();
     // ConnectionPool::getConnectionPool();
     return 0;
 }
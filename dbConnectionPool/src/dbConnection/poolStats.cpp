@@ -0,0 +1,124 @@
+#include"poolStats.hpp"
+#include<cstdio>
+#include<sstream>
+
+//Prometheus直方图的桶边界取2的幂微秒，输出时换算成秒
+static void appendHistogram(ostringstream& out,const string& name,const string& help,
+                            const string& label,const HistogramSnapshot& hist)
+{
+    out<<"# HELP "<<name<<" "<<help<<"\n";
+    out<<"# TYPE "<<name<<" histogram\n";
+    //最大的非空桶决定需要输出到哪个边界
+    int last=-1;
+    for(size_t i=0;i<hist.counts.size();i++)
+    {
+        if(hist.counts[i]!=0)
+        {
+            last=i;
+        }
+    }
+    uint64_t maxValue=last<0?0:LatencyHistogram::bucketUpper(last);
+    uint64_t cumulative=0;
+    size_t bucket=0;
+    for(uint64_t bound=1;;bound<<=1)
+    {
+        //le表示小于等于：桶中的值都不超过bound时，整个桶计入该边界
+        while(bucket<hist.counts.size()&&LatencyHistogram::bucketUpper(bucket)<=bound)
+        {
+            cumulative+=hist.counts[bucket++];
+        }
+        out<<name<<"_bucket{"<<label<<",le=\""<<bound/1e6<<"\"} "<<cumulative<<"\n";
+        if(bound>=maxValue||bound>=(1ULL<<62))
+        {
+            break;
+        }
+    }
+    out<<name<<"_bucket{"<<label<<",le=\"+Inf\"} "<<hist.total()<<"\n";
+    out<<name<<"_sum{"<<label<<"} "<<hist.sum/1e6<<"\n";
+    out<<name<<"_count{"<<label<<"} "<<hist.total()<<"\n";
+}
+
+static void appendMetric(ostringstream& out,const string& name,const char* type,
+                        const string& help,const string& label,double value)
+{
+    out<<"# HELP "<<name<<" "<<help<<"\n";
+    out<<"# TYPE "<<name<<" "<<type<<"\n";
+    out<<name<<"{"<<label<<"} "<<value<<"\n";
+}
+
+string PoolStats::toPrometheus(const string& poolName) const
+{
+    ostringstream out;
+    out.precision(9);
+    string label="pool=\""+poolName+"\"";
+    appendMetric(out,"dbpool_connections","gauge","Open connections.",label,totalConnections);
+    appendMetric(out,"dbpool_idle_connections","gauge","Idle connections.",label,idleConnections);
+    appendMetric(out,"dbpool_active_connections","gauge","Borrowed connections.",label,activeConnections);
+    appendMetric(out,"dbpool_waiters","gauge","Threads waiting for a connection.",label,waiters);
+    appendMetric(out,"dbpool_target_connections","gauge","Target size chosen by the sizing controller.",label,targetSize);
+    appendMetric(out,"dbpool_max_connections","gauge","Configured maximum pool size.",label,maxSize);
+    appendMetric(out,"dbpool_acquires_total","counter","Connection acquire attempts.",label,acquires);
+    appendMetric(out,"dbpool_acquire_timeouts_total","counter","Acquires that timed out.",label,timeouts);
+    appendMetric(out,"dbpool_breaker_rejects_total","counter","Acquires failed fast while the circuit breaker was open.",label,breakerRejects);
+    appendMetric(out,"dbpool_breaker_open","gauge","Whether the connect circuit breaker is open.",label,breakerOpen);
+    appendMetric(out,"dbpool_connect_failures_total","counter","Failed connection attempts.",label,connectFailures);
+    appendMetric(out,"dbpool_closed_connections_total","counter","Connections closed by the pool.",label,closedConnections);
+    appendHistogram(out,"dbpool_acquire_wait_seconds","Time spent waiting for a connection.",label,acquireWaitUs);
+    appendHistogram(out,"dbpool_connect_seconds","Time to establish a new connection.",label,connectLatencyUs);
+    return out.str();
+}
+
+//JSON中的直方图只输出常用的分位数
+static void appendJsonHistogram(ostringstream& out,const HistogramSnapshot& hist)
+{
+    out<<"{\"count\":"<<hist.total()
+        <<",\"mean\":"<<hist.mean()
+        <<",\"p50\":"<<hist.percentile(50)
+        <<",\"p90\":"<<hist.percentile(90)
+        <<",\"p99\":"<<hist.percentile(99)
+        <<",\"p999\":"<<hist.percentile(99.9)
+        <<",\"max\":"<<hist.percentile(100)<<"}";
+}
+
+string PoolStats::toJson() const
+{
+    ostringstream out;
+    out<<"{\"totalConnections\":"<<totalConnections
+        <<",\"idleConnections\":"<<idleConnections
+        <<",\"activeConnections\":"<<activeConnections
+        <<",\"waiters\":"<<waiters
+        <<",\"targetSize\":"<<targetSize
+        <<",\"maxSize\":"<<maxSize
+        <<",\"acquires\":"<<acquires
+        <<",\"timeouts\":"<<timeouts
+        <<",\"breakerRejects\":"<<breakerRejects
+        <<",\"breakerOpen\":"<<(breakerOpen?"true":"false")
+        <<",\"connectFailures\":"<<connectFailures
+        <<",\"closedConnections\":"<<closedConnections
+        <<",\"acquireWaitUs\":";
+    appendJsonHistogram(out,acquireWaitUs);
+    out<<",\"connectLatencyUs\":";
+    appendJsonHistogram(out,connectLatencyUs);
+    out<<"}";
+    return out.str();
+}
+
+bool PoolStats::writeFile(const string& path,const string& content)
+{
+    string tmpPath=path+".tmp";
+    FILE* fp=fopen(tmpPath.c_str(),"w");
+    if(!fp)
+    {
+        LOG("无法写入统计文件："+tmpPath);
+        return false;
+    }
+    bool ok=fwrite(content.data(),1,content.size(),fp)==content.size();
+    ok=fclose(fp)==0&&ok;
+    if(!ok||rename(tmpPath.c_str(),path.c_str())!=0)
+    {
+        LOG("写入统计文件失败："+path);
+        remove(tmpPath.c_str());
+        return false;
+    }
+    return true;
+}
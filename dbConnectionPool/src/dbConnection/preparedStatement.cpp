@@ -0,0 +1,211 @@
+#include"preparedStatement.hpp"
+#include"connection.hpp"
+#include<cstring>
+
+PreparedStatement::PreparedStatement(Connection* owner,MYSQL* conn)
+    :_owner(owner)
+{
+    _stmt=mysql_stmt_init(conn);
+}
+
+PreparedStatement::~PreparedStatement()
+{
+    if(_stmt)
+    {
+        freeResult();
+        mysql_stmt_close(_stmt);
+    }
+}
+
+bool PreparedStatement::prepare(const string& sql)
+{
+    if(_stmt==nullptr||mysql_stmt_prepare(_stmt,sql.c_str(),sql.size()))
+    {
+        LOG("预处理失败！");
+        LOG("错误信息："+string(_stmt?mysql_stmt_error(_stmt):"mysql_stmt_init失败")+"\n");
+        return false;
+    }
+    _sql=sql;
+    int cnt=mysql_stmt_param_count(_stmt);
+    _params.assign(cnt,Param());
+    _binds.assign(cnt,MYSQL_BIND());
+    for(int i=0;i<cnt;i++)
+    {
+        memset(&_binds[i],0,sizeof(MYSQL_BIND));
+        _binds[i].buffer_type=MYSQL_TYPE_NULL;
+        _binds[i].is_null=&_params[i].isNull;
+    }
+    return true;
+}
+
+void PreparedStatement::setInt(int idx,long long value)
+{
+    Param& param=_params[idx];
+    param.intValue=value;
+    param.isNull=false;
+    _binds[idx].buffer_type=MYSQL_TYPE_LONGLONG;
+    _binds[idx].buffer=&param.intValue;
+    _binds[idx].length=nullptr;
+}
+
+void PreparedStatement::setDouble(int idx,double value)
+{
+    Param& param=_params[idx];
+    param.doubleValue=value;
+    param.isNull=false;
+    _binds[idx].buffer_type=MYSQL_TYPE_DOUBLE;
+    _binds[idx].buffer=&param.doubleValue;
+    _binds[idx].length=nullptr;
+}
+
+void PreparedStatement::setString(int idx,const string& value)
+{
+    Param& param=_params[idx];
+    param.strValue=value;
+    param.length=param.strValue.size();
+    param.isNull=false;
+    _binds[idx].buffer_type=MYSQL_TYPE_STRING;
+    _binds[idx].buffer=const_cast<char*>(param.strValue.data());
+    _binds[idx].buffer_length=param.length;
+    _binds[idx].length=&param.length;
+}
+
+void PreparedStatement::setNull(int idx)
+{
+    _params[idx].isNull=true;
+    _binds[idx].buffer_type=MYSQL_TYPE_NULL;
+}
+
+bool PreparedStatement::execute()
+{
+    freeResult();
+    //参数的类型和地址可能变化，每次执行前重新绑定，绑定只在客户端进行不产生网络交互
+    if((!_binds.empty()&&mysql_stmt_bind_param(_stmt,_binds.data()))||mysql_stmt_execute(_stmt))
+    {
+        LOG("预处理语句执行失败！");
+        LOG("错误信息："+string(mysql_stmt_error(_stmt))+"\n");
+        return false;
+    }
+    //没有结果集的语句可能修改了表，和Connection::update一样失效查询缓存中这些表的结果
+    if(mysql_stmt_field_count(_stmt)==0)
+    {
+        _owner->afterStatement(_sql,false);
+        return true;
+    }
+    return bindResult();
+}
+
+bool PreparedStatement::bindResult()
+{
+    MYSQL_RES* meta=mysql_stmt_result_metadata(_stmt);
+    if(meta==nullptr)
+    {
+        return true;
+    }
+    //把结果集整体取到客户端，连接不会因为结果集没有读完而无法执行其他语句
+    //同时让客户端库统计每列的最大长度，据此分配接收缓冲区
+    bool updateMaxLength=true;
+    mysql_stmt_attr_set(_stmt,STMT_ATTR_UPDATE_MAX_LENGTH,&updateMaxLength);
+    if(mysql_stmt_store_result(_stmt))
+    {
+        LOG("读取预处理语句结果失败！");
+        LOG("错误信息："+string(mysql_stmt_error(_stmt))+"\n");
+        mysql_free_result(meta);
+        mysql_stmt_free_result(_stmt);
+        return false;
+    }
+    unsigned int fieldNum=mysql_num_fields(meta);
+    if(fieldNum==0)
+    {
+        mysql_free_result(meta);
+        mysql_stmt_free_result(_stmt);
+        return true;
+    }
+    MYSQL_FIELD* fields=mysql_fetch_fields(meta);
+    _columns.assign(fieldNum,Column());
+    _resultBinds.assign(fieldNum,MYSQL_BIND());
+    for(unsigned int i=0;i<fieldNum;i++)
+    {
+        Column& col=_columns[i];
+        //数值和时间类型的max_length是二进制长度而不是文本长度，至少留出64字节
+        col.buffer.resize(max<unsigned long>(fields[i].max_length,64));
+        MYSQL_BIND& bind=_resultBinds[i];
+        memset(&bind,0,sizeof(MYSQL_BIND));
+        bind.buffer_type=MYSQL_TYPE_STRING;
+        bind.buffer=&col.buffer[0];
+        bind.buffer_length=col.buffer.size();
+        bind.length=&col.length;
+        bind.is_null=&col.isNull;
+        bind.error=&col.truncated;
+    }
+    mysql_free_result(meta);
+    if(mysql_stmt_bind_result(_stmt,_resultBinds.data()))
+    {
+        LOG("绑定预处理语句结果失败！");
+        LOG("错误信息："+string(mysql_stmt_error(_stmt))+"\n");
+        freeResult();
+        return false;
+    }
+    return true;
+}
+
+bool PreparedStatement::fetch()
+{
+    if(_columns.empty())
+    {
+        return false;
+    }
+    int ret=mysql_stmt_fetch(_stmt);
+    if(ret==MYSQL_DATA_TRUNCATED)
+    {
+        //缓冲区不够时扩大到该列的实际长度，重新读取这一列，之后的行也使用扩大后的缓冲区
+        for(unsigned int i=0;i<_columns.size();i++)
+        {
+            Column& col=_columns[i];
+            if(!col.truncated)
+            {
+                continue;
+            }
+            col.buffer.resize(col.length);
+            _resultBinds[i].buffer=&col.buffer[0];
+            _resultBinds[i].buffer_length=col.buffer.size();
+            if(mysql_stmt_fetch_column(_stmt,&_resultBinds[i],i,0))
+            {
+                ret=1;
+                break;
+            }
+            col.truncated=false;
+        }
+        if(ret!=1)
+        {
+            mysql_stmt_bind_result(_stmt,_resultBinds.data());
+            ret=0;
+        }
+    }
+    if(ret==0)
+    {
+        return true;
+    }
+    if(ret==1)
+    {
+        LOG("读取预处理语句结果失败！");
+        LOG("错误信息："+string(mysql_stmt_error(_stmt))+"\n");
+    }
+    freeResult();
+    return false;
+}
+
+void PreparedStatement::freeResult()
+{
+    if(!_columns.empty())
+    {
+        mysql_stmt_free_result(_stmt);
+        _columns.clear();
+        _resultBinds.clear();
+    }
+}
+
+unsigned long long PreparedStatement::affectedRows()
+{
+    return mysql_stmt_affected_rows(_stmt);
+}
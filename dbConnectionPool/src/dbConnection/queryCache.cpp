@@ -0,0 +1,711 @@
+#include"queryCache.hpp"
+#include<cctype>
+#include<cstring>
+
+//去掉反引号和库名前缀
+static string tableName(const string& token)
+{
+    string name;
+    for(char c:token)
+    {
+        if(c!='`')
+        {
+            name+=c;
+        }
+    }
+    size_t dot=name.find_last_of('.');
+    return dot==string::npos?name:name.substr(dot+1);
+}
+
+static bool isIdentifier(const string& token)
+{
+    return !token.empty()&&(isalpha((unsigned char)token[0])||token[0]=='_'||token[0]=='`');
+}
+
+//表名列表之后可能出现的关键字，不能当作别名
+static bool isClauseKeyword(const string& token)
+{
+    static const unordered_set<string> keywords={
+        "where","join","inner","left","right","cross","natural","straight_join","on","using",
+        "group","order","limit","having","union","for","lock","set","values","value","select",
+        "partition","use","force","ignore","into","window","procedure"
+    };
+    return keywords.count(token)>0;
+}
+
+//从tokens[pos]开始解析逗号分隔的表名列表，每个表名后面可以跟别名
+static void parseTableList(const vector<string>& tokens,size_t pos,vector<string>& tables)
+{
+    while(pos<tokens.size()&&isIdentifier(tokens[pos])&&!isClauseKeyword(tokens[pos]))
+    {
+        tables.push_back(tableName(tokens[pos]));
+        pos++;
+        if(pos<tokens.size()&&tokens[pos]=="as")
+        {
+            pos+=2;
+        }
+        else if(pos<tokens.size()&&isIdentifier(tokens[pos])&&!isClauseKeyword(tokens[pos]))
+        {
+            pos++;
+        }
+        if(pos>=tokens.size()||tokens[pos]!=",")
+        {
+            break;
+        }
+        pos++;
+    }
+}
+
+//从sql[pos]开始跳过空白和注释，/*!...*/中的内容按语句处理，只跳过注释的标记
+static void skipSpace(const string& sql,size_t& pos)
+{
+    while(pos<sql.size())
+    {
+        char c=sql[pos];
+        if(isspace((unsigned char)c))
+        {
+            pos++;
+        }
+        else if(c=='#'||(c=='-'&&sql.compare(pos,2,"--")==0&&(pos+2==sql.size()||isspace((unsigned char)sql[pos+2]))))
+        {
+            size_t end=sql.find('\n',pos);
+            pos=end==string::npos?sql.size():end+1;
+        }
+        else if(sql.compare(pos,3,"/*!")==0)
+        {
+            pos+=3;
+            while(pos<sql.size()&&isdigit((unsigned char)sql[pos]))
+            {
+                pos++;
+            }
+        }
+        else if(sql.compare(pos,2,"/*")==0)
+        {
+            size_t end=sql.find("*/",pos+2);
+            pos=end==string::npos?sql.size():end+2;
+        }
+        else if(sql.compare(pos,2,"*/")==0)
+        {
+            pos+=2;
+        }
+        else
+        {
+            break;
+        }
+    }
+}
+
+//跳过从sql[pos]开始的引号字面量或反引号标识符
+static void skipQuoted(const string& sql,size_t& pos)
+{
+    char quote=sql[pos++];
+    while(pos<sql.size())
+    {
+        char c=sql[pos++];
+        if(c=='\\'&&quote!='`')
+        {
+            pos++;
+        }
+        else if(c==quote)
+        {
+            //两个连续的引号表示引号本身
+            if(pos<sql.size()&&sql[pos]==quote)
+            {
+                pos++;
+            }
+            else
+            {
+                return;
+            }
+        }
+    }
+}
+
+//从sql[pos]开始读取下一个单词，跳过空白和注释，关键字和标识符转为小写
+//引号中的字面量只返回引号，不拷贝其内容；到达sql末尾返回空串
+static string nextToken(const string& sql,size_t& pos)
+{
+    skipSpace(sql,pos);
+    if(pos>=sql.size())
+    {
+        return string();
+    }
+    char c=sql[pos];
+    if(c=='\''||c=='"')
+    {
+        skipQuoted(sql,pos);
+        return string(1,c);
+    }
+    if(isalnum((unsigned char)c)||c=='_'||c=='$'||c=='`'||c=='.')
+    {
+        string token;
+        while(pos<sql.size())
+        {
+            c=sql[pos];
+            if(c=='`')
+            {
+                //与normalize一致，反引号中的标识符也转为小写
+                size_t start=pos;
+                skipQuoted(sql,pos);
+                for(size_t i=start;i<pos;i++)
+                {
+                    token+=tolower((unsigned char)sql[i]);
+                }
+            }
+            else if(isalnum((unsigned char)c)||c=='_'||c=='$'||c=='.')
+            {
+                token+=tolower((unsigned char)c);
+                pos++;
+            }
+            else
+            {
+                break;
+            }
+        }
+        return token;
+    }
+    pos++;
+    return string(1,c);
+}
+
+//跳到下一条语句的开头，只扫描字符，不拷贝
+static void skipStatement(const string& sql,size_t& pos)
+{
+    while(pos<sql.size())
+    {
+        //普通字符占绝大多数，直接跳到下一个可能改变状态的字符
+        const char* data=sql.data();
+        size_t size=sql.size();
+        while(pos<size)
+        {
+            char c=data[pos];
+            if(c=='\''||c=='"'||c=='`'||c==';'||c=='#'||c=='-'||c=='/')
+            {
+                break;
+            }
+            pos++;
+        }
+        if(pos>=sql.size())
+        {
+            return;
+        }
+        char c=sql[pos];
+        if(c==';')
+        {
+            pos++;
+            return;
+        }
+        if(c=='\''||c=='"'||c=='`')
+        {
+            skipQuoted(sql,pos);
+            continue;
+        }
+        size_t start=pos;
+        skipSpace(sql,pos);
+        if(pos==start)
+        {
+            pos++;
+        }
+    }
+}
+
+//写语句中修改的表都出现在这些关键字之前，之后的值列表、赋值、条件和子查询不需要解析
+static bool isHeadEnd(const string& token)
+{
+    return token=="values"||token=="value"||token=="set"||token=="select"||
+        token=="where"||token=="order"||token=="limit";
+}
+
+//不修改数据的语句；create table ... select和create or replace view会改变查询结果，不在其中
+static bool isReadOnlyVerb(const string& verb)
+{
+    static const unordered_set<string> verbs={
+        "select","show","set","begin","start","commit","rollback","savepoint","release",
+        "use","explain","describe","desc"
+    };
+    return verbs.count(verb)>0;
+}
+
+//所有FROM和JOIN之后的表，子查询中的表也会被找到
+static void collectReadTables(const vector<string>& tokens,vector<string>& tables)
+{
+    for(size_t i=0;i<tokens.size();i++)
+    {
+        if(tokens[i]=="from"||tokens[i]=="join"||tokens[i]=="straight_join")
+        {
+            parseTableList(tokens,i+1,tables);
+        }
+    }
+}
+
+//一条写语句开头部分的单词中修改的表
+static void statementWriteTables(const vector<string>& tokens,vector<string>& tables)
+{
+    const string& verb=tokens[0];
+    if(verb=="insert"||verb=="replace")
+    {
+        for(size_t i=1;i<tokens.size();i++)
+        {
+            if(tokens[i]=="into")
+            {
+                parseTableList(tokens,i+1,tables);
+                break;
+            }
+        }
+    }
+    else if(verb=="update")
+    {
+        size_t pos=1;
+        while(pos<tokens.size()&&(tokens[pos]=="low_priority"||tokens[pos]=="ignore"))
+        {
+            pos++;
+        }
+        parseTableList(tokens,pos,tables);
+        //多表更新中JOIN的表也可能被修改
+        collectReadTables(tokens,tables);
+    }
+    else if(verb=="delete")
+    {
+        collectReadTables(tokens,tables);
+    }
+    else if(verb=="rename")
+    {
+        //rename table a to b, c to d：原表和新表都受影响
+        for(size_t i=2;i<tokens.size();i++)
+        {
+            if(isIdentifier(tokens[i])&&tokens[i]!="to")
+            {
+                tables.push_back(tableName(tokens[i]));
+            }
+        }
+    }
+    else if(verb=="create")
+    {
+        //create table/view的目标表，create index作用的表；其它create语句找不到表，调用者清空整个缓存
+        for(size_t i=1;i<tokens.size();i++)
+        {
+            if(tokens[i]=="table"||tokens[i]=="view")
+            {
+                size_t pos=i+1;
+                while(pos<tokens.size()&&(tokens[pos]=="if"||tokens[pos]=="not"||tokens[pos]=="exists"))
+                {
+                    pos++;
+                }
+                parseTableList(tokens,pos,tables);
+                break;
+            }
+            else if(tokens[i]=="index"&&i+2<tokens.size()&&tokens[i+2]=="on")
+            {
+                parseTableList(tokens,i+3,tables);
+                break;
+            }
+        }
+    }
+    else if(verb=="truncate"||verb=="alter"||verb=="drop"||verb=="load")
+    {
+        for(size_t i=1;i<tokens.size();i++)
+        {
+            if(tokens[i]=="table")
+            {
+                size_t pos=i+1;
+                while(pos<tokens.size()&&(tokens[pos]=="if"||tokens[pos]=="not"||tokens[pos]=="exists"))
+                {
+                    pos++;
+                }
+                parseTableList(tokens,pos,tables);
+                break;
+            }
+            else if(verb=="truncate"&&i==1)
+            {
+                parseTableList(tokens,i,tables);
+                break;
+            }
+        }
+    }
+}
+
+QueryCache::QueryCache(size_t maxBytes,int defaultTtlMs)
+    :_maxBytes(maxBytes),_defaultTtlMs(defaultTtlMs),_usedBytes(0),_version(0),_clearVersion(0),
+    _hits(0),_misses(0),_evictions(0),_expirations(0),_invalidations(0)
+{
+}
+
+//MySQL的保留字，不加引号时不能用作表名和别名，规范化时可以安全地转为小写
+static bool isReservedWord(const string& lower)
+{
+    static const unordered_set<string> words={
+        "select","from","where","and","or","not","xor","in","is","null","true","false","as",
+        "join","inner","left","right","outer","cross","natural","straight_join","on","using",
+        "group","by","order","asc","desc","limit","having","union","all","distinct","distinctrow",
+        "like","regexp","rlike","between","exists","case","when","then","else","with","recursive",
+        "for","update","lock","into","div","mod","interval","binary","collate","high_priority",
+        "sql_calc_found_rows","sql_small_result","sql_big_result","sql_buffer_result","over","window",
+        "partition","force","ignore","use","index","key","escape"
+    };
+    return words.count(lower)>0;
+}
+
+string QueryCache::normalize(const string& sql)
+{
+    string result;
+    result.reserve(sql.size());
+    char quote=0;
+    bool space=false;
+    for(size_t i=0;i<sql.size();i++)
+    {
+        char c=sql[i];
+        if(quote!=0)
+        {
+            result+=c;
+            //反引号中的反斜杠不是转义符
+            if(c=='\\'&&quote!='`'&&i+1<sql.size())
+            {
+                result+=sql[++i];
+            }
+            else if(c==quote)
+            {
+                quote=0;
+            }
+            continue;
+        }
+        if(isspace((unsigned char)c))
+        {
+            space=true;
+            continue;
+        }
+        if(space&&!result.empty())
+        {
+            result+=' ';
+        }
+        space=false;
+        if(c=='\''||c=='"'||c=='`')
+        {
+            quote=c;
+            result+=c;
+            continue;
+        }
+        if(isalpha((unsigned char)c)||c=='_'||c=='$')
+        {
+            //表名和别名在lower_case_table_names=0时区分大小写，只有保留字转为小写
+            size_t end=i;
+            string lower;
+            while(end<sql.size()&&(isalnum((unsigned char)sql[end])||sql[end]=='_'||sql[end]=='$'))
+            {
+                lower+=tolower((unsigned char)sql[end]);
+                end++;
+            }
+            bool qualified=(i>0&&sql[i-1]=='.')||(end<sql.size()&&sql[end]=='.');
+            if(!qualified&&isReservedWord(lower))
+            {
+                result+=lower;
+            }
+            else
+            {
+                result.append(sql,i,end-i);
+            }
+            i=end-1;
+            continue;
+        }
+        result+=c;
+    }
+    while(!result.empty()&&(result.back()==';'||result.back()==' '))
+    {
+        result.pop_back();
+    }
+    return result;
+}
+
+bool QueryCache::cacheable(const string& normalizedSql)
+{
+    vector<string> tokens=QueryCache::tokens(normalizedSql);
+    if(tokens.empty()||tokens[0]!="select")
+    {
+        return false;
+    }
+    //结果随时间、会话或者服务器状态变化的函数，只有后面跟着括号时才是函数调用（user、database也可能是表名）
+    static const unordered_set<string> volatileFunctions={
+        "rand","uuid","uuid_short","now","sysdate","curdate","curtime","unix_timestamp",
+        "from_unixtime","last_insert_id","found_rows","row_count","connection_id","database","schema",
+        "user","session_user","system_user","current_user","current_role","version","sleep","benchmark",
+        "get_lock","release_lock","is_free_lock","is_used_lock","master_pos_wait","load_file"
+    };
+    //不带括号也可以使用的时间和会话关键字，以及要求不缓存或者带锁的子句
+    static const unordered_set<string> volatileWords={
+        "current_timestamp","current_date","current_time","current_user","localtime","localtimestamp",
+        "utc_date","utc_time","utc_timestamp","sql_no_cache","into"
+    };
+    for(size_t i=0;i<tokens.size();i++)
+    {
+        const string& token=tokens[i];
+        bool call=i+1<tokens.size()&&tokens[i+1]=="(";
+        if(volatileWords.count(token)>0||(call&&volatileFunctions.count(token)>0))
+        {
+            return false;
+        }
+        //@用户变量和@@系统变量
+        if(token=="@")
+        {
+            return false;
+        }
+        //for update、for share、lock in share mode
+        if((token=="for"&&i+1<tokens.size()&&(tokens[i+1]=="update"||tokens[i+1]=="share"))||
+            (token=="lock"&&i+1<tokens.size()&&tokens[i+1]=="in"))
+        {
+            return false;
+        }
+        //系统库的内容反映服务器当前的状态
+        if(token.compare(0,18,"information_schema")==0||token.compare(0,18,"performance_schema")==0||
+            token.compare(0,4,"sys.")==0||token.compare(0,6,"mysql.")==0)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+vector<string> QueryCache::readTables(const string& normalizedSql)
+{
+    vector<string> tables;
+    collectReadTables(QueryCache::tokens(normalizedSql),tables);
+    return tables;
+}
+
+vector<string> QueryCache::tokens(const string& sql)
+{
+    vector<string> tokens;
+    size_t pos=0;
+    for(string token=nextToken(sql,pos);!token.empty();token=nextToken(sql,pos))
+    {
+        tokens.push_back(token);
+    }
+    return tokens;
+}
+
+shared_ptr<const CachedResult> QueryCache::get(const string& key)
+{
+    lock_guard<mutex> lock(_mtx);
+    auto it=_index.find(key);
+    if(it==_index.end())
+    {
+        _misses++;
+        return nullptr;
+    }
+    if(it->second->expireAt<=chrono::steady_clock::now())
+    {
+        erase(it->second);
+        _expirations++;
+        _misses++;
+        return nullptr;
+    }
+    _lru.splice(_lru.begin(),_lru,it->second);
+    _hits++;
+    return it->second->result;
+}
+
+void QueryCache::put(const string& key,const vector<string>& tables,
+            shared_ptr<const CachedResult> result,uint64_t version,int ttlMs)
+{
+    //按字符串内容估算结果占用的内存
+    size_t bytes=key.size()+sizeof(Entry);
+    for(const string& name:result->fieldNames)
+    {
+        bytes+=name.size()+sizeof(string);
+    }
+    for(const vector<string>& row:result->rows)
+    {
+        bytes+=sizeof(row);
+        for(const string& field:row)
+        {
+            bytes+=field.size()+sizeof(string);
+        }
+    }
+    if(bytes>_maxBytes)
+    {
+        return;
+    }
+
+    lock_guard<mutex> lock(_mtx);
+    //查询期间相关的表被写入过，结果可能是写入之前读到的旧数据，放入缓存会一直保留到TTL到期
+    if(_clearVersion>version)
+    {
+        return;
+    }
+    for(const string& table:tables)
+    {
+        auto vit=_tableVersions.find(table);
+        if(vit!=_tableVersions.end()&&vit->second>version)
+        {
+            return;
+        }
+    }
+    auto it=_index.find(key);
+    if(it!=_index.end())
+    {
+        erase(it->second);
+    }
+    //超出内存上限，从链表尾部淘汰最久未使用的条目
+    while(_usedBytes+bytes>_maxBytes&&!_lru.empty())
+    {
+        erase(prev(_lru.end()));
+        _evictions++;
+    }
+
+    Entry entry;
+    entry.key=key;
+    entry.result=move(result);
+    entry.tables=tables;
+    entry.bytes=bytes;
+    entry.expireAt=chrono::steady_clock::now()+chrono::milliseconds(ttlMs<0?_defaultTtlMs:ttlMs);
+    _lru.push_front(move(entry));
+    _index[key]=_lru.begin();
+    for(const string& table:tables)
+    {
+        _tableIndex[table].insert(key);
+    }
+    _usedBytes+=bytes;
+}
+
+void QueryCache::invalidateTable(const string& table)
+{
+    lock_guard<mutex> lock(_mtx);
+    invalidateLocked(table);
+}
+
+void QueryCache::invalidateTables(const vector<string>& tables)
+{
+    if(tables.empty())
+    {
+        clear();
+        return;
+    }
+    lock_guard<mutex> lock(_mtx);
+    for(const string& table:tables)
+    {
+        invalidateLocked(table);
+    }
+}
+
+bool QueryCache::writeTargets(const string& sql,vector<string>& tables,bool multiStatements)
+{
+    //每条语句只解析到值列表或条件之前，批量插入这样的长语句不需要整体规范化和切分
+    bool write=false;
+    size_t pos=0;
+    while(pos<sql.size())
+    {
+        string token=nextToken(sql,pos);
+        if(token.empty())
+        {
+            break;
+        }
+        //不修改数据的语句不需要失效，也不需要继续解析
+        if(token!=";"&&!isReadOnlyVerb(token))
+        {
+            vector<string> tokens;
+            tokens.push_back(move(token));
+            while(!(token=nextToken(sql,pos)).empty()&&token!=";"&&!isHeadEnd(token))
+            {
+                tokens.push_back(move(token));
+            }
+            write=true;
+            size_t known=tables.size();
+            statementWriteTables(tokens,tables);
+            if(tables.size()==known)
+            {
+                //无法确定影响了哪些表，例如存储过程调用，tables为空时调用者只能清空整个缓存
+                tables.clear();
+                return true;
+            }
+        }
+        if(!multiStatements)
+        {
+            break;
+        }
+        if(token!=";")
+        {
+            skipStatement(sql,pos);
+        }
+    }
+    return write;
+}
+
+void QueryCache::invalidateFor(const string& sql,bool multiStatements)
+{
+    vector<string> tables;
+    if(writeTargets(sql,tables,multiStatements))
+    {
+        invalidateTables(tables);
+    }
+}
+
+void QueryCache::clear()
+{
+    lock_guard<mutex> lock(_mtx);
+    _clearVersion=++_version;
+    //清空之后每张表的版本号都不会超过_clearVersion，不再需要单独记录
+    _tableVersions.clear();
+    _invalidations+=_lru.size();
+    _lru.clear();
+    _index.clear();
+    _tableIndex.clear();
+    _usedBytes=0;
+}
+
+QueryCacheStats QueryCache::stats()
+{
+    lock_guard<mutex> lock(_mtx);
+    QueryCacheStats st;
+    st.hits=_hits;
+    st.misses=_misses;
+    st.evictions=_evictions;
+    st.expirations=_expirations;
+    st.invalidations=_invalidations;
+    st.entries=_lru.size();
+    st.bytes=_usedBytes;
+    return st;
+}
+
+void QueryCache::erase(EntryIter it)
+{
+    for(const string& table:it->tables)
+    {
+        auto tit=_tableIndex.find(table);
+        if(tit!=_tableIndex.end())
+        {
+            tit->second.erase(it->key);
+            if(tit->second.empty())
+            {
+                _tableIndex.erase(tit);
+            }
+        }
+    }
+    _usedBytes-=it->bytes;
+    _index.erase(it->key);
+    _lru.erase(it);
+}
+
+void QueryCache::invalidateLocked(const string& table)
+{
+    //表上当前没有条目时也要记录版本号，正在执行的查询据此丢弃它读到的旧结果
+    _tableVersions[table]=++_version;
+    eraseTable(table);
+}
+
+void QueryCache::eraseTable(const string& table)
+{
+    auto tit=_tableIndex.find(table);
+    if(tit==_tableIndex.end())
+    {
+        return;
+    }
+    //erase会修改_tableIndex，先把key拷贝出来
+    vector<string> keys(tit->second.begin(),tit->second.end());
+    for(const string& key:keys)
+    {
+        auto it=_index.find(key);
+        if(it!=_index.end())
+        {
+            erase(it->second);
+            _invalidations++;
+        }
+    }
+}
@@ -0,0 +1,150 @@
+#include"readWriteRouter.hpp"
+#include<cstdlib>
+#include<unordered_set>
+
+ReadWriteRouter* ReadWriteRouter::getRouter()
+{
+    static ReadWriteRouter* router=[]()->ReadWriteRouter*
+    {
+        ConnectionPool* primary=ConnectionPool::getConnectionPool();
+        return primary==nullptr?nullptr:new ReadWriteRouter(primary,primary->getReplicas());
+    }();
+    return router;
+}
+
+ReadWriteRouter::ReadWriteRouter(ConnectionPool* primary,const vector<string>& replicas)
+    :_primary(primary),_next(0)
+{
+    for(const string& endpoint:replicas)
+    {
+        size_t colon=endpoint.find_last_of(':');
+        string ip=endpoint.substr(0,colon);
+        unsigned short port=colon==string::npos?3306:atoi(endpoint.substr(colon+1).c_str());
+        //从库可以读取主库查询放入缓存的结果，但从库的查询结果可能落后于主库，不放入缓存
+        ConnectionPool* replica=new ConnectionPool(primary->getName(),ip,port,primary->getQueryCache());
+        if(!replica->started())
+        {
+            LOG("从库"+endpoint+"的连接池加载配置失败！");
+            delete replica;
+            continue;
+        }
+        _replicas.push_back(replica);
+    }
+}
+
+PooledConnection ReadWriteRouter::getWriteConnection()
+{
+    return _primary->getConnection();
+}
+
+PooledConnection ReadWriteRouter::getReadConnection()
+{
+    //从轮转起点开始找未完成请求最少的从库，负载相同的从库轮流被选中
+    //熔断器打开的从库不参与选择，避免依次等待每个不可用从库的获取超时
+    size_t num=_replicas.size();
+    size_t start=num==0?0:_next++%num;
+    vector<size_t> candidates;
+    candidates.reserve(num);
+    for(size_t i=0;i<num;i++)
+    {
+        size_t idx=(start+i)%num;
+        if(!_replicas[idx]->breakerOpen())
+        {
+            candidates.push_back(idx);
+        }
+    }
+    if(candidates.empty())
+    {
+        if(num>0)
+        {
+            LOG("所有从库熔断，读请求改用主库！");
+        }
+        return _primary->getConnection();
+    }
+    size_t best=0;
+    int bestLoad=_replicas[candidates[0]]->outstanding();
+    for(size_t i=1;i<candidates.size();i++)
+    {
+        int load=_replicas[candidates[i]]->outstanding();
+        if(load<bestLoad)
+        {
+            best=i;
+            bestLoad=load;
+        }
+    }
+    for(size_t i=0;i<candidates.size();i++)
+    {
+        ConnectionPool* replica=_replicas[candidates[(best+i)%candidates.size()]];
+        //前一个从库等待期间熔断器可能已经打开
+        if(i>0&&replica->breakerOpen())
+        {
+            continue;
+        }
+        PooledConnection conn=replica->getConnection();
+        if(conn!=nullptr)
+        {
+            return conn;
+        }
+    }
+    LOG("所有从库获取连接失败，读请求改用主库！");
+    return _primary->getConnection();
+}
+
+PooledConnection ReadWriteRouter::getConnection(const string& sql)
+{
+    return isReadOnly(sql)?getReadConnection():getWriteConnection();
+}
+
+bool ReadWriteRouter::isReadOnly(const string& sql)
+{
+    //按单词判断，字符串字面量和注释中的内容不会被当作关键字
+    vector<string> tokens=QueryCache::tokens(sql);
+    //去掉开头的括号，(select ...) union (select ...)也是只读的
+    size_t pos=0;
+    while(pos<tokens.size()&&tokens[pos]=="(")
+    {
+        pos++;
+    }
+    if(pos>=tokens.size())
+    {
+        return false;
+    }
+    static const unordered_set<string> readVerbs={"select","show","describe","desc","explain","with"};
+    if(readVerbs.count(tokens[pos])==0)
+    {
+        return false;
+    }
+    bool with=tokens[pos]=="with";
+    //这些函数读写会话或连接上的状态，必须在主库执行
+    static const unordered_set<string> primaryFunctions={"get_lock","release_lock","last_insert_id","nextval"};
+    static const string none;
+    for(size_t i=pos;i<tokens.size();i++)
+    {
+        const string& token=tokens[i];
+        const string& next=i+1<tokens.size()?tokens[i+1]:none;
+        //多条语句中可能夹带写语句，末尾的分号不影响
+        if(token==";")
+        {
+            if(next.empty()||next==";")
+            {
+                continue;
+            }
+            return false;
+        }
+        //加锁读必须在主库的事务里执行，select ... into会写变量或文件
+        if((token=="for"&&(next=="update"||next=="share"))||(token=="lock"&&next=="in")||token=="into")
+        {
+            return false;
+        }
+        if(next=="("&&primaryFunctions.count(token)>0)
+        {
+            return false;
+        }
+        //with可以引导update/delete/insert语句
+        if(with&&(token=="update"||token=="delete"||token=="insert"||token=="replace"))
+        {
+            return false;
+        }
+    }
+    return true;
+}
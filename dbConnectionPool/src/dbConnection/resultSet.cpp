@@ -0,0 +1,103 @@
+#include"resultSet.hpp"
+#include"connection.hpp"
+
+ResultSet::ResultSet()
+    :_conn(nullptr),_res(nullptr),_fields(nullptr),_fieldNum(0)
+{
+}
+
+ResultSet::ResultSet(Connection* conn,MYSQL_RES* res)
+    :_conn(conn),_res(res),_fields(nullptr),_fieldNum(0)
+{
+    if(_res!=nullptr)
+    {
+        _fieldNum=mysql_num_fields(_res);
+        _fields=mysql_fetch_fields(_res);
+        attach();
+    }
+}
+
+ResultSet::~ResultSet()
+{
+    close();
+}
+
+ResultSet::ResultSet(ResultSet&& other) noexcept
+    :_conn(other._conn),_res(other._res),_fields(other._fields),
+    _fieldNum(other._fieldNum),_row(other._row)
+{
+    other._conn=nullptr;
+    other._res=nullptr;
+    attach();
+}
+
+ResultSet& ResultSet::operator=(ResultSet&& other) noexcept
+{
+    if(this!=&other)
+    {
+        close();
+        _conn=other._conn;
+        _res=other._res;
+        _fields=other._fields;
+        _fieldNum=other._fieldNum;
+        _row=other._row;
+        other._conn=nullptr;
+        other._res=nullptr;
+        attach();
+    }
+    return *this;
+}
+
+void ResultSet::attach()
+{
+    if(_res!=nullptr&&_conn!=nullptr)
+    {
+        _conn->_activeResult=this;
+    }
+}
+
+string_view ResultSet::fieldName(unsigned int idx) const
+{
+    return string_view(_fields[idx].name);
+}
+
+bool ResultSet::next()
+{
+    if(_res==nullptr)
+    {
+        return false;
+    }
+    _row._row=mysql_fetch_row(_res);
+    if(_row._row==nullptr)
+    {
+        return false;
+    }
+    _row._lengths=mysql_fetch_lengths(_res);
+    _row._fieldNum=_fieldNum;
+    return true;
+}
+
+ResultSet::iterator ResultSet::begin()
+{
+    return next()?iterator(this):iterator();
+}
+
+void ResultSet::close()
+{
+    if(_res==nullptr)
+    {
+        return;
+    }
+    //mysql_use_result的结果必须读完才能在连接上执行下一条语句
+    while(mysql_fetch_row(_res)!=nullptr)
+    {
+    }
+    mysql_free_result(_res);
+    _res=nullptr;
+    _row=Row();
+    if(_conn!=nullptr&&_conn->_activeResult==this)
+    {
+        _conn->_activeResult=nullptr;
+    }
+    _conn=nullptr;
+}
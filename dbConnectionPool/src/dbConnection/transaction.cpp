@@ -0,0 +1,218 @@
+#include"transaction.hpp"
+
+Transaction::Transaction(Connection* conn,bool pipelineBegin)
+    :_conn(conn),_state(PENDING_BEGIN)
+{
+    if(!pipelineBegin||!_conn->multiStatements())
+    {
+        beginNow();
+    }
+}
+
+Transaction::~Transaction()
+{
+    if(_state==STARTED)
+    {
+        rollback();
+    }
+}
+
+bool Transaction::beginNow()
+{
+    if(_state!=PENDING_BEGIN)
+    {
+        return _state==STARTED;
+    }
+    _state=_conn->update("start transaction")?STARTED:DONE;
+    return _state==STARTED;
+}
+
+bool Transaction::update(const string& sql)
+{
+    if(_state==PENDING_BEGIN&&_conn->multiStatements())
+    {
+        //BEGIN和第一条语句一起发送
+        vector<PipelineResult> results;
+        _conn->pipeline({"start transaction",sql},results);
+        _state=results[0].ok?STARTED:DONE;
+        return results[1].ok;
+    }
+    if(!beginNow())
+    {
+        return false;
+    }
+    return _conn->update(sql);
+}
+
+ResultSet Transaction::query(const string& sql)
+{
+    //多语句包中的结果集无法以流式结果集返回，查询前单独发送BEGIN
+    if(!beginNow())
+    {
+        return ResultSet();
+    }
+    return _conn->query(sql);
+}
+
+bool Transaction::commit()
+{
+    State state=_state;
+    _state=DONE;
+    //还没有执行过任何语句，不需要访问服务器
+    if(state==PENDING_BEGIN)
+    {
+        return true;
+    }
+    return state==STARTED&&_conn->update("commit");
+}
+
+bool Transaction::rollback()
+{
+    State state=_state;
+    _state=DONE;
+    if(state==PENDING_BEGIN)
+    {
+        return true;
+    }
+    return state==STARTED&&_conn->update("rollback");
+}
+
+GroupCommitter::GroupCommitter(ConnectionPool* pool,int windowMs,size_t maxGroupSize)
+    :_pool(pool),_windowMs(windowMs),_maxGroupSize(max<size_t>(1,maxGroupSize)),_stop(false)
+{
+    _flusher=thread(&GroupCommitter::flushTask,this);
+}
+
+GroupCommitter::~GroupCommitter()
+{
+    {
+        lock_guard<mutex> lock(_mtx);
+        _stop=true;
+    }
+    _cv.notify_one();
+    _flusher.join();
+}
+
+future<bool> GroupCommitter::submit(vector<string> stmts)
+{
+    PendingTxn txn;
+    txn.stmts=move(stmts);
+    txn.arrive=chrono::steady_clock::now();
+    future<bool> fut=txn.done.get_future();
+    unique_lock<mutex> lock(_mtx);
+    if(_stop)
+    {
+        lock.unlock();
+        txn.done.set_value(false);
+        return fut;
+    }
+    _queue.push_back(move(txn));
+    //第一个事务开始计时，攒够一组时提前刷新，其它时候不需要唤醒刷新线程
+    if(_queue.size()==1||_queue.size()>=_maxGroupSize)
+    {
+        _cv.notify_one();
+    }
+    return fut;
+}
+
+void GroupCommitter::flushTask()
+{
+    while(1)
+    {
+        vector<PendingTxn> group;
+        {
+            unique_lock<mutex> lock(_mtx);
+            _cv.wait(lock,[this](){return _stop||!_queue.empty();});
+            if(_queue.empty())
+            {
+                return;
+            }
+            //第一个事务到达后最多等待一个刷新窗口；停止时不再等待，把剩余的事务提交完
+            chrono::steady_clock::time_point deadline=_queue.front().arrive+chrono::milliseconds(_windowMs);
+            _cv.wait_until(lock,deadline,[this](){return _stop||_queue.size()>=_maxGroupSize;});
+            size_t num=min(_queue.size(),_maxGroupSize);
+            for(size_t i=0;i<num;i++)
+            {
+                group.push_back(move(_queue.front()));
+                _queue.pop_front();
+            }
+        }
+        commitGroup(group);
+    }
+}
+
+void GroupCommitter::commitGroup(vector<PendingTxn>& group)
+{
+    vector<char> ok(group.size(),0);
+    bool committed=false;
+    PooledConnection conn=_pool->getConnection();
+    if(conn!=nullptr)
+    {
+        //整组放在一个多语句包中：BEGIN; SAVEPOINT s0; 事务0的语句; RELEASE SAVEPOINT s0; ...; COMMIT
+        //某条语句失败时服务器不再执行后面的语句，回滚到失败事务的保存点后，从下一个事务继续发送
+        const size_t CONTROL=(size_t)-1;
+        bool begun=false;
+        size_t next=0;
+        while(1)
+        {
+            vector<string> stmts;
+            //每条语句所属的事务，BEGIN、SAVEPOINT和COMMIT为CONTROL；released标记各事务最后的RELEASE SAVEPOINT
+            vector<size_t> owner;
+            vector<char> released;
+            if(!begun)
+            {
+                stmts.push_back("start transaction");
+                owner.push_back(CONTROL);
+                released.push_back(0);
+            }
+            for(size_t k=next;k<group.size();k++)
+            {
+                stmts.push_back("savepoint gc"+to_string(k));
+                owner.push_back(CONTROL);
+                released.push_back(0);
+                for(const string& stmt:group[k].stmts)
+                {
+                    stmts.push_back(stmt);
+                    owner.push_back(k);
+                    released.push_back(0);
+                }
+                stmts.push_back("release savepoint gc"+to_string(k));
+                owner.push_back(k);
+                released.push_back(1);
+            }
+            stmts.push_back("commit");
+            owner.push_back(CONTROL);
+            released.push_back(0);
+
+            vector<PipelineResult> results;
+            conn->pipeline(stmts,results);
+            size_t failed=0;
+            while(failed<results.size()&&results[failed].ok)
+            {
+                //RELEASE SAVEPOINT执行成功说明该事务的语句全部成功
+                if(released[failed])
+                {
+                    ok[owner[failed]]=1;
+                }
+                failed++;
+            }
+            if(failed==results.size())
+            {
+                committed=true;
+                break;
+            }
+            begun=begun||results[0].ok;
+            //BEGIN、SAVEPOINT或COMMIT失败，或者服务器已经回滚了整个事务（此时保存点也不存在了），整组失败
+            if(owner[failed]==CONTROL||!conn->update("rollback to savepoint gc"+to_string(owner[failed])))
+            {
+                conn->update("rollback");
+                break;
+            }
+            next=owner[failed]+1;
+        }
+    }
+    for(size_t k=0;k<group.size();k++)
+    {
+        group[k].done.set_value(committed&&ok[k]);
+    }
+}
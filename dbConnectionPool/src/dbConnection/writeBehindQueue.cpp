@@ -0,0 +1,196 @@
+#include"writeBehindQueue.hpp"
+#include"batchInsert.hpp"
+
+WriteBehindQueue::WriteBehindQueue(ConnectionPool* pool,const string& insertHead,size_t capacity,
+                                size_t flushRows,int flushIntervalMs,OverflowPolicy policy,int maxRetries)
+    :_pool(pool),_insertHead(insertHead),_capacity(max<size_t>(1,capacity)),
+    _flushRows(max<size_t>(1,min(flushRows,capacity))),_flushIntervalMs(flushIntervalMs),_policy(policy),
+    _maxRetries(max(0,maxRetries)),
+    _queued(0),_enqueuedSeq(0),_doneSeq(0),_flushRequested(false),_stop(false),
+    _dropped(0),_written(0),_failed(0)
+{
+    _flusher=thread(&WriteBehindQueue::flushTask,this);
+}
+
+WriteBehindQueue::~WriteBehindQueue()
+{
+    {
+        lock_guard<mutex> lock(_mtx);
+        _stop=true;
+    }
+    _flushCv.notify_one();
+    _flusher.join();
+}
+
+bool WriteBehindQueue::enqueue(WriteBehindRow row)
+{
+    unique_lock<mutex> lock(_mtx);
+    if(_queued>=_capacity)
+    {
+        if(_policy==OverflowPolicy::DROP)
+        {
+            lock.unlock();
+            _dropped++;
+            return false;
+        }
+        _spaceCv.wait(lock,[this](){return _queued<_capacity;});
+    }
+    if(_buffer.empty())
+    {
+        //只有缓冲区的第一行需要读时钟，用于按时间触发刷新
+        _oldest=chrono::steady_clock::now();
+    }
+    _buffer.push_back(move(row));
+    _queued++;
+    _enqueuedSeq++;
+    //第一行开始计时，攒够一批时提前刷新，其它时候不需要唤醒刷新线程
+    if(_buffer.size()==1||_buffer.size()==_flushRows)
+    {
+        _flushCv.notify_one();
+    }
+    return true;
+}
+
+bool WriteBehindQueue::flush(int timeoutMs)
+{
+    unique_lock<mutex> lock(_mtx);
+    unsigned long long target=_enqueuedSeq;
+    if(_doneSeq>=target)
+    {
+        return true;
+    }
+    _flushRequested=true;
+    _flushCv.notify_one();
+    if(timeoutMs<0)
+    {
+        _spaceCv.wait(lock,[this,target](){return _doneSeq>=target;});
+        return true;
+    }
+    return _spaceCv.wait_for(lock,chrono::milliseconds(timeoutMs),[this,target](){return _doneSeq>=target;});
+}
+
+WriteBehindStats WriteBehindQueue::stats()
+{
+    WriteBehindStats st;
+    {
+        lock_guard<mutex> lock(_mtx);
+        st.enqueued=_enqueuedSeq;
+    }
+    st.dropped=_dropped;
+    st.written=_written;
+    st.failed=_failed;
+    return st;
+}
+
+void WriteBehindQueue::flushTask()
+{
+    //借不到连接时保留下来、下次重试的行，以及已经重试的次数
+    vector<WriteBehindRow> rows;
+    int retries=0;
+    while(1)
+    {
+        bool stopping=false;
+        {
+            unique_lock<mutex> lock(_mtx);
+            while(1)
+            {
+                //停止时把剩余的行写完再退出
+                if(_stop||_flushRequested||_buffer.size()>=_flushRows)
+                {
+                    break;
+                }
+                if(_buffer.empty())
+                {
+                    if(!rows.empty())
+                    {
+                        break;
+                    }
+                    _flushCv.wait(lock);
+                    continue;
+                }
+                chrono::steady_clock::time_point deadline=_oldest+chrono::milliseconds(_flushIntervalMs);
+                if(_flushCv.wait_until(lock,deadline)==cv_status::timeout)
+                {
+                    break;
+                }
+            }
+            if(_stop&&_buffer.empty()&&rows.empty())
+            {
+                return;
+            }
+            stopping=_stop;
+            _flushRequested=false;
+            //换出整个缓冲区，写入期间调用者继续向新的缓冲区追加
+            if(rows.empty())
+            {
+                rows.swap(_buffer);
+            }
+            else
+            {
+                for(WriteBehindRow& row:_buffer)
+                {
+                    rows.push_back(move(row));
+                }
+                _buffer.clear();
+            }
+        }
+
+        long long failed=writeRows(rows);
+        if(failed<0)
+        {
+            //连接池没有可用连接，稍后重试；停止或者重试次数用完时放弃这些行，计为失败
+            //数据库长时间不可用时不会一直占着队列容量，阻塞的调用者和flush都能返回
+            if(!stopping&&retries<_maxRetries)
+            {
+                retries++;
+                this_thread::sleep_for(chrono::milliseconds(_flushIntervalMs));
+                continue;
+            }
+            LOG("写回队列多次获取连接失败，放弃"+to_string(rows.size())+"行！");
+            failed=rows.size();
+        }
+        retries=0;
+        _written+=rows.size()-failed;
+        _failed+=failed;
+        {
+            lock_guard<mutex> lock(_mtx);
+            _queued-=rows.size();
+            _doneSeq+=rows.size();
+        }
+        _spaceCv.notify_all();
+        rows.clear();
+    }
+}
+
+long long WriteBehindQueue::writeRows(vector<WriteBehindRow>& rows)
+{
+    PooledConnection conn=_pool->getConnection();
+    if(conn==nullptr)
+    {
+        LOG("写回队列获取连接失败，稍后重试！");
+        return -1;
+    }
+    BatchInsert batch=conn->insertBatch(_insertHead);
+    for(const WriteBehindRow& row:rows)
+    {
+        for(const optional<string>& value:row)
+        {
+            if(value)
+            {
+                batch.addValue(*value);
+            }
+            else
+            {
+                batch.addNull();
+            }
+        }
+        batch.endRow();
+    }
+    batch.flush();
+    long long failed=0;
+    for(const BatchError& error:batch.errors())
+    {
+        failed+=error.rowCount;
+    }
+    return failed;
+}